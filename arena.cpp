@@ -0,0 +1,102 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <memory.h>
+#include "common.h"
+#include "arena.h"
+
+// ______________________________________________
+// arenas
+
+#define	ARENA_BLOCK_SIZE	(64 * 1024)
+#define	ARENA_ALIGN		16
+
+typedef struct arenablock_s
+{
+	struct arenablock_s	*next;
+	long			numbytes;
+
+	// pads the header to 32 bytes so the block memory after it stays as
+	// aligned as malloc's
+	long			pad[2];
+
+} arenablock_t;
+
+void Arena_Init(arena_t *arena)
+{
+	memset(arena, 0, sizeof(arena_t));
+}
+
+void Arena_Free(arena_t *arena)
+{
+	arenablock_t	*block, *next;
+
+	for (block = arena->blocks; block; block = next)
+	{
+		next = block->next;
+		free(block);
+	}
+
+	Arena_Init(arena);
+}
+
+static void Arena_AddBlock(arena_t *arena, int numbytes)
+{
+	arenablock_t	*block;
+
+	// big allocations get a block to themselves
+	if (numbytes < ARENA_BLOCK_SIZE)
+		numbytes = ARENA_BLOCK_SIZE;
+
+	block = (arenablock_t*)Malloc(sizeof(arenablock_t) + numbytes);
+	block->numbytes = numbytes;
+
+	block->next	= arena->blocks;
+	arena->blocks	= block;
+	arena->cur	= (char*)(block + 1);
+	arena->end	= arena->cur + numbytes;
+}
+
+void *Arena_Alloc(arena_t *arena, int numbytes)
+{
+	void	*p;
+
+	numbytes = (numbytes + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	if (arena->end - arena->cur < numbytes)
+		Arena_AddBlock(arena, numbytes);
+
+	p = arena->cur;
+	arena->cur += numbytes;
+	arena->numbytes += numbytes;
+
+	memset(p, 0, numbytes);
+
+	return p;
+}
+
+arenamark_t Arena_Mark(arena_t *arena)
+{
+	arenamark_t	mark;
+
+	mark.block	= arena->blocks;
+	mark.cur	= arena->cur;
+	mark.numbytes	= arena->numbytes;
+
+	return mark;
+}
+
+void Arena_Rewind(arena_t *arena, arenamark_t mark)
+{
+	arenablock_t	*next;
+
+	while (arena->blocks != mark.block)
+	{
+		next = arena->blocks->next;
+		free(arena->blocks);
+		arena->blocks = next;
+	}
+
+	arena->cur	= mark.cur;
+	arena->end	= mark.block ? (char*)(mark.block + 1) + mark.block->numbytes : NULL;
+	arena->numbytes	= mark.numbytes;
+}
@@ -0,0 +1,41 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+// ______________________________________________
+// arenas
+
+// a bump allocator that hands out memory from large blocks, everything in the
+// arena is released at once. an arena is not thread safe, give each thread its own
+typedef struct arena_s
+{
+	struct arenablock_s	*blocks;
+	char			*cur;
+	char			*end;
+
+	// bytes handed out since the arena was last freed
+	long			numbytes;
+
+} arena_t;
+
+// a point in the arena to rewind back to
+typedef struct arenamark_s
+{
+	struct arenablock_s	*block;
+	char			*cur;
+	long			numbytes;
+
+} arenamark_t;
+
+void Arena_Init(arena_t *arena);
+
+// releases all the arena's memory
+void Arena_Free(arena_t *arena);
+
+// returns zeroed 16 byte aligned memory
+void *Arena_Alloc(arena_t *arena, int numbytes);
+
+// releases everything allocated after the mark was taken
+arenamark_t Arena_Mark(arena_t *arena);
+void Arena_Rewind(arena_t *arena, arenamark_t mark);
+
+#endif
@@ -18,7 +18,7 @@ void box2::Clear()
 
 bool box2::InsideOut()
 {
-	return (min[0] <= max[0]) && (min[1] <= max[1]) && (min[2] <= max[2]);
+	return (min[0] > max[0]) || (min[1] > max[1]);
 }
 
 void box2::AddPoint(vec2 p)
@@ -38,15 +38,15 @@ void box2::AddBox(box2 b)
 	{
 		if (b.min[i] < min[i])
 			min[i] = b.min[i];
-		if (b.min[i] > max[i])
+		if (b.max[i] > max[i])
 			max[i] = b.max[i];
 	}
 }
 
 void box2::Expand(float d)
 {
-	min[0]	+= d;
-	min[1]	+= d;
+	min[0]	-= d;
+	min[1]	-= d;
 	
 	max[0]	+= d;
 	max[1]	+= d;
@@ -65,8 +65,8 @@ bool box2::ContainsPoints(vec2 p)
 
 bool box2::IntersectsBox(box2 b)
 {
-	if ((b.min[0] < max[0] || b.max[0] > min[0]) &&
-	    (b.min[1] < max[1] || b.max[1] > min[1]))
+	if ((b.min[0] <= max[0] && b.max[0] >= min[0]) &&
+	    (b.min[1] <= max[1] && b.max[1] >= min[1]))
 	{
 		return true;
 	}
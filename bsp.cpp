@@ -0,0 +1,2407 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <memory.h>
+#include <math.h>
+#include <string.h>
+#include <float.h>
+#include "common.h"
+#include "vec2.h"
+#include "box2.h"
+#include "plane2.h"
+#include "polygon.h"
+#include "bsp.h"
+#include "lineset.h"
+#include "threads.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// ______________________________________________
+// build memory
+
+// per thread state while building the tree
+typedef struct bspworker_s
+{
+	// nodes and split lines made by this thread
+	arena_t			arena;
+
+	// per plane pair scratch used when selecting a split plane
+	int			markcount;
+	int			*planemarks;
+	int			*planeslots;
+
+	// the lines at the node being split, packed for scoring
+	lineset_t		lineset;
+
+	// for each side of the last partition, the lines that didn't go down
+	// that side unchanged and the split fragments that did
+	lineset_t		removed[2];
+	lineset_t		added[2];
+
+} bspworker_t;
+
+void *BuildMalloc(bspbuild_t *build, int numbytes)
+{
+	return Arena_Alloc(&build->arena, numbytes);
+}
+
+bspbuild_t *AllocBuild()
+{
+	bspbuild_t	*build;
+
+	build = (bspbuild_t*)MallocZeroed(sizeof(bspbuild_t));
+	build->epsilon = 0.2f;
+
+	return build;
+}
+
+void ResetBuild(bspbuild_t *build)
+{
+	bsptree_t *tree = build->tree;
+
+	if (tree && tree->leafpolygons)
+	{
+		for (int i = 0; i < tree->numcleafs; i++)
+		{
+			if (tree->leafpolygons[i])
+				Polygon_Free(tree->leafpolygons[i]);
+		}
+	}
+
+	// the workers live in the build arena so release their arenas first
+	for (int i = 0; i < build->numworkers; i++)
+		Arena_Free(&build->workers[i].arena);
+
+	Arena_Free(&build->arena);
+
+	build->numvertices	= 0;
+	build->vertices		= NULL;
+	build->numlinedefs	= 0;
+	build->linedefs		= NULL;
+	build->bspnodes		= NULL;
+	build->tree		= NULL;
+	build->numworkers	= 0;
+	build->workers		= NULL;
+
+	build->numplanes	= 0;
+	build->maxplanes	= 0;
+	build->planes		= NULL;
+	build->exactplanes	= NULL;
+	build->planehash	= NULL;
+	build->planechain	= NULL;
+}
+
+void FreeBuild(bspbuild_t *build)
+{
+	if (!build)
+		return;
+
+	ResetBuild(build);
+	free(build);
+}
+
+void SetMapData(bspbuild_t *build, const vec2 *vertices, int numvertices, const linedef_t *linedefs, int numlinedefs)
+{
+	build->numvertices	= numvertices;
+	build->vertices		= (vec2*)BuildMalloc(build, numvertices * sizeof(vec2));
+	build->numlinedefs	= numlinedefs;
+	build->linedefs		= (linedef_t*)BuildMalloc(build, numlinedefs * sizeof(linedef_t));
+
+	memcpy(build->vertices, vertices, numvertices * sizeof(vec2));
+	memcpy(build->linedefs, linedefs, numlinedefs * sizeof(linedef_t));
+}
+
+// ______________________________________________
+// lines
+
+vec2 Plane_GetNormal(plane_t plane)
+{
+	return plane.GetNormal();
+}
+
+float GetDistance(plane_t plane)
+{
+	return plane.GetDistance();
+}
+
+float Plane_PointDistance(plane_t plane, vec2 p)
+{
+	return plane.Distance(p);
+}
+
+int Plane_PointOnPlaneSide(plane_t plane, vec2 p, float epsilon)
+{
+	return plane.PointOnPlaneSide(p, epsilon);
+}
+
+line_t *Line_Alloc(arena_t *arena)
+{
+	return (line_t*)Arena_Alloc(arena, sizeof(line_t));
+}
+
+line_t *Line_Copy(arena_t *arena, line_t *s)
+{
+	line_t *d;
+
+	d = Line_Alloc(arena);
+	d->v[0] = s->v[0];
+	d->v[1] = s->v[1];
+
+	return d;
+}
+
+int Line_OnPlaneSide(line_t *l, plane_t plane, float epsilon) 
+{
+	int sides[2];
+
+	sides[0] = Plane_PointOnPlaneSide(plane, l->v[0], epsilon);
+	sides[1] = Plane_PointOnPlaneSide(plane, l->v[1], epsilon);
+
+	if (sides[0] == PLANE_SIDE_ON && sides[1] == PLANE_SIDE_ON)
+		return PLANE_SIDE_ON;
+
+	// if nothing on the back side then line is in front
+	if (sides[0] != PLANE_SIDE_BACK && sides[1] != PLANE_SIDE_BACK)
+		return PLANE_SIDE_FRONT;
+
+	// if nothing on front side then line is on back side
+	if (sides[0] != PLANE_SIDE_FRONT && sides[1] != PLANE_SIDE_FRONT)
+		return PLANE_SIDE_BACK;
+
+	return PLANE_SIDE_CROSS;
+}
+
+void Line_SplitWithPlane(arena_t *arena, line_t *l, plane_t plane, float epsilon, line_t **f, line_t **b)
+{
+	int sides[2];
+
+	sides[0] = Plane_PointOnPlaneSide(plane, l->v[0], epsilon);
+	sides[1] = Plane_PointOnPlaneSide(plane, l->v[1], epsilon);
+
+	// both points are on the plane
+	if (sides[0] == PLANE_SIDE_ON && sides[1] == PLANE_SIDE_ON)
+	{
+		*f = NULL;
+		*b = NULL;
+		return;
+	}
+
+	// if nothing on back side then line is in front
+	if (sides[0] != PLANE_SIDE_BACK && sides[1] != PLANE_SIDE_BACK)
+	{
+		*f = Line_Copy(arena, l);
+		*b = NULL;
+		return;
+	}
+
+	// if nothing on front side then line is on back side
+	if (sides[0] != PLANE_SIDE_FRONT && sides[1] != PLANE_SIDE_FRONT)
+	{
+		*f = NULL;
+		*b = Line_Copy(arena, l);
+		return;
+	}
+
+	// the points cross the plane so generate a split point
+	{
+		vec2 mid;
+		int i;
+
+		// calculate split point
+		for (i = 0; i < 2; i++)
+		{
+			// avoid round off error when possible
+			if (plane[i] == 1)
+			{
+				mid[i] = -plane[2];
+			}
+			else if (plane[i] == -1)
+			{
+				mid[i] = plane[2];
+			}
+			else
+			{
+				float dist1, dist2, dot;
+				
+				dist1 = Distance(plane, l->v[0]);
+				dist2 = Distance(plane, l->v[1]);
+				dot = dist1 / (dist1 - dist2);
+				mid[i] = (l->v[0][i] * (1.0f - dot)) + (dot * l->v[1][i]);
+			}
+		}
+
+		// create the new front and back lines
+		if (sides[0] == PLANE_SIDE_FRONT)
+		{
+			*f = Line_Alloc(arena);
+			*b = Line_Alloc(arena);
+			(*f)->v[0] = l->v[0];
+			(*f)->v[1] = mid;
+			(*b)->v[0] = mid;
+			(*b)->v[1] = l->v[1];
+		}
+		else
+		{
+			*f = Line_Alloc(arena);
+			*b = Line_Alloc(arena);
+			(*b)->v[0] = l->v[0];
+			(*b)->v[1] = mid;
+			(*f)->v[0] = mid;
+			(*f)->v[1] = l->v[1];
+		}
+	}
+}
+
+vec2 Line_GetNormal(line_t *l)
+{
+	vec2 n;
+
+	n = l->v[1] - l->v[0];
+	n = Skew(n);
+	n = Normalize(n);
+
+	return n;
+}
+
+plane_t Line_Plane(line_t *l)
+{
+	vec2		n;
+	plane_t		plane;
+
+	n = Line_GetNormal(l);
+
+	plane[0] = n[0];
+	plane[1] = n[1];
+	plane[2] = -Dot(n, l->v[0]);
+
+	return plane;
+}
+
+// ______________________________________________
+// planes
+
+#define	NUM_PLANE_HASHES	1024
+#define	PLANE_NORMAL_EPSILON	0.00001f
+#define	PLANE_DIST_EPSILON	0.01f
+
+static void InitPlanes(bspbuild_t *build, int maxplanes)
+{
+	build->numplanes	= 0;
+	build->maxplanes	= maxplanes;
+	build->planes		= (plane_t*)BuildMalloc(build, maxplanes * sizeof(plane_t));
+	build->planechain	= (int*)BuildMalloc(build, maxplanes * sizeof(int));
+	build->planehash	= (int*)BuildMalloc(build, NUM_PLANE_HASHES * sizeof(int));
+
+	if (build->exact)
+		build->exactplanes = (exactplane_t*)BuildMalloc(build, maxplanes * sizeof(exactplane_t));
+
+	for (int i = 0; i < NUM_PLANE_HASHES; i++)
+		build->planehash[i] = -1;
+}
+
+static int PlaneHash(float dist)
+{
+	return (int)floorf(dist) & (NUM_PLANE_HASHES - 1);
+}
+
+static bool PlaneEqual(plane_t a, plane_t b)
+{
+	return
+		fabsf(a[0] - b[0]) < PLANE_NORMAL_EPSILON &&
+		fabsf(a[1] - b[1]) < PLANE_NORMAL_EPSILON &&
+		fabsf(a[2] - b[2]) < PLANE_DIST_EPSILON;
+}
+
+// returns the number of the plane, adding it and its opposite if it's new
+static int FindPlane(bspbuild_t *build, plane_t plane)
+{
+	plane_t	canonical;
+	int	hash;
+
+	// the even plane of each pair faces along the positive axes
+	canonical = plane;
+	if (canonical[0] < 0.0f || (canonical[0] == 0.0f && canonical[1] < 0.0f))
+		canonical = -plane;
+
+	// the dist epsilon is smaller than a hash bucket so only the neighbouring buckets need checking
+	hash = PlaneHash(canonical[2]);
+
+	for (int h = hash - 1; h <= hash + 1; h++)
+	{
+		for (int i = build->planehash[h & (NUM_PLANE_HASHES - 1)]; i >= 0; i = build->planechain[i])
+		{
+			if (PlaneEqual(build->planes[i], canonical))
+				return PlaneEqual(build->planes[i], plane) ? i : i + 1;
+		}
+	}
+
+	if (build->numplanes + 2 > build->maxplanes)
+		Error("FindPlane: MAX_PLANES\n");
+
+	int planenum = build->numplanes;
+	build->numplanes += 2;
+
+	build->planes[planenum + 0] = canonical;
+	build->planes[planenum + 1] = -canonical;
+
+	build->planechain[planenum]			= build->planehash[hash & (NUM_PLANE_HASHES - 1)];
+	build->planehash[hash & (NUM_PLANE_HASHES - 1)]	= planenum;
+
+	return PlaneEqual(canonical, plane) ? planenum : planenum + 1;
+}
+
+static int64_t GCD(int64_t a, int64_t b)
+{
+	while (b)
+	{
+		int64_t t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+// the exact plane through two integer points, planes are matched exactly after
+// dividing out the common factor of the coefficients
+static int FindExactPlane(bspbuild_t *build, int x0, int y0, int x1, int y1)
+{
+	int64_t	a = y1 - y0;
+	int64_t	b = x0 - x1;
+	int64_t	c = -(a * x0 + b * y0);
+	int64_t	divisor = GCD(GCD(llabs(a), llabs(b)), llabs(c));
+	bool	flip;
+	int	hash;
+
+	// only possible for a zero length line, which MakeLineList leaves out
+	if (!divisor)
+		Error("FindExactPlane: degenerate plane\n");
+
+	a /= divisor;
+	b /= divisor;
+	c /= divisor;
+
+	// the even plane of each pair faces along the positive axes
+	flip = a < 0 || (a == 0 && b < 0);
+	if (flip)
+	{
+		a = -a;
+		b = -b;
+		c = -c;
+	}
+
+	hash = (int)((c * 31 + b) * 31 + a) & (NUM_PLANE_HASHES - 1);
+
+	for (int i = build->planehash[hash]; i >= 0; i = build->planechain[i])
+	{
+		exactplane_t *p = build->exactplanes + i;
+
+		if (p->a == a && p->b == b && p->c == c * FRACUNIT)
+			return flip ? i + 1 : i;
+	}
+
+	if (build->numplanes + 2 > build->maxplanes)
+		Error("FindExactPlane: MAX_PLANES\n");
+
+	int planenum = build->numplanes;
+	build->numplanes += 2;
+
+	build->exactplanes[planenum + 0] = ExactPlane_Make(a, b, c);
+	build->exactplanes[planenum + 1] = ExactPlane_Reverse(build->exactplanes[planenum]);
+
+	// the float plane for the tree nodes
+	double length = sqrt((double)(a * a + b * b));
+	build->planes[planenum + 0] = plane_t((float)(a / length), (float)(b / length), (float)(c / length));
+	build->planes[planenum + 1] = -build->planes[planenum + 0];
+
+	build->planechain[planenum]	= build->planehash[hash];
+	build->planehash[hash]		= planenum;
+
+	return flip ? planenum + 1 : planenum;
+}
+
+// the even plane of a pair faces along the positive axes, which is all IsAxial checks for
+static bool PlaneIsAxial(bspbuild_t *build, int planenum)
+{
+	return build->planes[planenum & ~1].IsAxial();
+}
+
+// ______________________________________________
+// bsp tree
+
+typedef struct bspline_s
+{
+	struct bspline_s	*next;
+	line_t			*line;
+
+	// plane of the original linedef, split fragments keep the plane of the line they came from
+	int			planenum;
+
+	// the line in fixed point for exact builds
+	fixedline_t		*fixed;
+
+} bspline_t;
+
+// nodes are linked into the build and tree lists once the tree is built, see LinkTreeNodes
+static bspnode_t *AllocNode(arena_t *arena)
+{
+	return (bspnode_t*)Arena_Alloc(arena, sizeof(bspnode_t));
+}
+
+static bsptree_t *MallocTree(bspbuild_t *build)
+{
+	return (bsptree_t*)BuildMalloc(build, sizeof(bsptree_t));
+}
+
+static bspline_t *MallocBSPLine(arena_t *arena, line_t *line)
+{
+	bspline_t	*p;
+	
+	p = (bspline_t*)Arena_Alloc(arena, sizeof(bspline_t));
+	p->line = line;
+	
+	return p;
+}
+
+static bspnode_t *MallocBSPNode(arena_t *arena, bsptree_t *tree, bspnode_t *parent)
+{
+	bspnode_t *n = AllocNode(arena);
+	
+	n->parent = parent;
+	n->tree	= tree;
+	
+	return n;
+}
+
+static line_t *FixedToLine(arena_t *arena, const fixedline_t *fixed)
+{
+	line_t *line = Line_Alloc(arena);
+
+	for (int i = 0; i < 2; i++)
+	{
+		line->v[i].x = (float)fixed->v[i][0] / FRACUNIT;
+		line->v[i].y = (float)fixed->v[i][1] / FRACUNIT;
+	}
+
+	return line;
+}
+
+static bspline_t *MallocFixedLine(arena_t *arena, const fixedline_t *fixed, int planenum)
+{
+	bspline_t *p = (bspline_t*)Arena_Alloc(arena, sizeof(bspline_t));
+
+	p->fixed = (fixedline_t*)Arena_Alloc(arena, sizeof(fixedline_t));
+	*p->fixed = *fixed;
+	p->line = FixedToLine(arena, fixed);
+	p->planenum = planenum;
+
+	return p;
+}
+
+// the same as Line_SplitWithPlane with exact sides and split points rounded to
+// fixed point. the split point is where the plane crosses the line's own
+// plane, so fragments stay within epsilon of it however often they're split
+static void SplitFixedLine(arena_t *arena, const exactplane_t *plane, const exactplane_t *lineplane, bspline_t *l, bspline_t **f, bspline_t **b)
+{
+	const fixedline_t	*fl = l->fixed;
+	fixedline_t		pieces[2];
+	fixed_t			mid[2];
+
+	*f = *b = NULL;
+
+	switch (FixedLine_OnPlaneSide(fl, plane))
+	{
+	case PLANE_SIDE_ON:
+		return;
+	case PLANE_SIDE_FRONT:
+		*f = MallocFixedLine(arena, fl, l->planenum);
+		return;
+	case PLANE_SIDE_BACK:
+		*b = MallocFixedLine(arena, fl, l->planenum);
+		return;
+	}
+
+	if (!ExactPlane_Intersect(lineplane, plane, mid))
+		FixedLine_SplitPoint(fl, plane, mid);
+
+	// the piece from the first point goes on the first point's side
+	int side = ExactPlane_PointOnPlaneSide(plane, fl->v[0][0], fl->v[0][1]);
+
+	pieces[0] = *fl;
+	pieces[0].v[1][0] = mid[0];
+	pieces[0].v[1][1] = mid[1];
+	pieces[1] = *fl;
+	pieces[1].v[0][0] = mid[0];
+	pieces[1].v[0][1] = mid[1];
+
+	*f = MallocFixedLine(arena, &pieces[side == PLANE_SIDE_FRONT ? 0 : 1], l->planenum);
+	*b = MallocFixedLine(arena, &pieces[side == PLANE_SIDE_FRONT ? 1 : 0], l->planenum);
+}
+
+static void SplitLine(bspbuild_t *build, arena_t *arena, int planenum, bspline_t *l, bspline_t **f, bspline_t **b)
+{
+	line_t *ff, *bb;
+
+	*f = *b = NULL;
+
+	// a line on the plane's pair is always on it, whatever rounding did to its
+	// ends, so every split takes at least the lines of its own plane away
+	if ((l->planenum >> 1) == (planenum >> 1))
+		return;
+
+	if (build->exact)
+	{
+		SplitFixedLine(arena, build->exactplanes + planenum, build->exactplanes + l->planenum, l, f, b);
+		return;
+	}
+	
+	// split the line
+	Line_SplitWithPlane(arena, l->line, build->planes[planenum], build->epsilon, &ff, &bb);
+	
+	if (ff)
+	{
+		*f = MallocBSPLine(arena, ff);
+		(*f)->planenum = l->planenum;
+	}
+	if (bb)
+	{
+		*b = MallocBSPLine(arena, bb);
+		(*b)->planenum = l->planenum;
+	}
+	
+	// check that the split polygon sits in the original's plane
+	//if (*f && !CheckPolygonOnPlane(*f, PolygonPlane(p)))
+	//	Error("Front polygon doesn't sit on original plane after split\n");
+	//if (*b && !CheckPolygonOnPlane(*b, PolygonPlane(p)))
+	//	Error("Back polygon doesn't sit on original plane after split\n");
+}
+
+// ______________________________________________
+// split heuristics
+
+// how a node's lines fall on a candidate split plane. while a plane is still
+// being scored the side counts only cover the lines classified so far
+typedef struct splitinfo_s
+{
+	// lines on each side, indexed by PLANE_SIDE_*
+	int	sides[4];
+
+	int	numlines;
+	int	depth;
+	bool	axial;
+
+} splitinfo_t;
+
+// each heuristic scores a plane, higher is better, and bounds the best score
+// the plane can still reach with the given number of lines left to classify
+// so scoring can stop once a plane can't beat the best one so far
+
+// favour planes that don't cause splits
+struct MinSplitsHeuristic
+{
+	static float Score(const splitinfo_t *s)
+	{
+		return (float)(s->numlines - s->sides[PLANE_SIDE_CROSS]);
+	}
+
+	static float Bound(const splitinfo_t *s, int /*remaining*/)
+	{
+		return Score(s);
+	}
+};
+
+// the lines that end up on each side, split lines go down both
+static int Imbalance(const splitinfo_t *s)
+{
+	return abs(s->sides[PLANE_SIDE_FRONT] - s->sides[PLANE_SIDE_BACK]);
+}
+
+// the imbalance left if the remaining lines all go down the smaller side
+static int MinImbalance(const splitinfo_t *s, int remaining)
+{
+	int imbalance = Imbalance(s) - remaining;
+
+	return imbalance > 0 ? imbalance : 0;
+}
+
+#define	BALANCE_SPLIT_COST	5.0f
+
+// favour planes with as many lines in front as behind, trading off against splits
+struct BalanceHeuristic
+{
+	static float Score(const splitinfo_t *s)
+	{
+		return -BALANCE_SPLIT_COST * s->sides[PLANE_SIDE_CROSS] - Imbalance(s);
+	}
+
+	static float Bound(const splitinfo_t *s, int remaining)
+	{
+		return -BALANCE_SPLIT_COST * s->sides[PLANE_SIDE_CROSS] - MinImbalance(s, remaining);
+	}
+};
+
+// an axial plane is worth this fraction of the node's lines
+#define	AXIAL_BONUS		0.25f
+
+// favour planes that don't cause splits, preferring axial ones
+struct AxialHeuristic
+{
+	static float Score(const splitinfo_t *s)
+	{
+		return MinSplitsHeuristic::Score(s) + (s->axial ? AXIAL_BONUS * s->numlines : 0.0f);
+	}
+
+	static float Bound(const splitinfo_t *s, int /*remaining*/)
+	{
+		return Score(s);
+	}
+};
+
+#define	DEPTH_SPLIT_COST	1.0f
+#define	DEPTH_BALANCE_COST	8.0f
+
+// keep the tree shallow by weighting balance heavily near the root, falling
+// back towards fewest splits further down
+struct DepthHeuristic
+{
+	static float Scale(const splitinfo_t *s)
+	{
+		return DEPTH_BALANCE_COST / (float)(s->depth + 1);
+	}
+
+	static float Score(const splitinfo_t *s)
+	{
+		return -DEPTH_SPLIT_COST * s->sides[PLANE_SIDE_CROSS] - Scale(s) * Imbalance(s);
+	}
+
+	static float Bound(const splitinfo_t *s, int remaining)
+	{
+		return -DEPTH_SPLIT_COST * s->sides[PLANE_SIDE_CROSS] - Scale(s) * MinImbalance(s, remaining);
+	}
+};
+
+static const char *splitheuristicnames[NUM_SPLIT_HEURISTICS] =
+{
+	"minsplits",
+	"balance",
+	"axial",
+	"depth",
+};
+
+int FindSplitHeuristic(const char *name)
+{
+	for (int i = 0; i < NUM_SPLIT_HEURISTICS; i++)
+	{
+		if (!strcmp(splitheuristicnames[i], name))
+			return i;
+	}
+
+	return -1;
+}
+
+const char *SplitHeuristicName(int heuristic)
+{
+	return splitheuristicnames[heuristic];
+}
+
+static void AddLine(bspbuild_t *build, lineset_t *set, bspline_t *l)
+{
+	if (build->exact)
+		LineSet_AddFixed(set, l->fixed);
+	else
+		LineSet_Add(set, l->line->v[0].x, l->line->v[0].y, l->line->v[1].x, l->line->v[1].y);
+}
+
+static void ClassifyLines(bspbuild_t *build, const lineset_t *set, int first, int numlines, int planenum, int counts[4])
+{
+	if (build->exact)
+		LineSet_ClassifyFixed(set, first, numlines, build->exactplanes + planenum, counts);
+	else
+		LineSet_Classify(set, first, numlines, build->planes[planenum], build->epsilon, counts);
+}
+
+// lines are classified in runs of this many between checks of the bound
+#define	SCORE_RUN_LINES		64
+
+// returns false if the plane can't beat the best score
+template <class heuristic>
+static bool ScoreSplitPlane(bspbuild_t *build, const lineset_t *lines, int planenum, splitinfo_t *info, bool havebest, float bestscore, float *score)
+{
+	memset(info->sides, 0, sizeof(info->sides));
+
+	for (int first = 0; first < lines->numlines; first += SCORE_RUN_LINES)
+	{
+		int numlines = lines->numlines - first;
+		if (numlines > SCORE_RUN_LINES)
+			numlines = SCORE_RUN_LINES;
+
+		ClassifyLines(build, lines, first, numlines, planenum, info->sides);
+
+		if (havebest && heuristic::Bound(info, lines->numlines - first - numlines) <= bestscore)
+			return false;
+	}
+
+	*score = heuristic::Score(info);
+
+	return !havebest || *score > bestscore;
+}
+
+// ______________________________________________
+// split plane selection
+
+typedef struct splitcandidate_s
+{
+	int	planenum;
+	int	order;
+	float	weight;
+
+} splitcandidate_t;
+
+// heavier candidates first, falling back to the order the planes were found
+static int CompareCandidates(const void *a, const void *b)
+{
+	const splitcandidate_t *ca = (const splitcandidate_t*)a;
+	const splitcandidate_t *cb = (const splitcandidate_t*)b;
+
+	if (ca->weight != cb->weight)
+		return ca->weight > cb->weight ? -1 : 1;
+
+	return ca->order - cb->order;
+}
+
+static int CompareCandidateOrder(const void *a, const void *b)
+{
+	return ((const splitcandidate_t*)a)->order - ((const splitcandidate_t*)b)->order;
+}
+
+// gather the distinct planes of the lines in the list, collinear lines share a
+// plane so each plane only gets scored once
+static int GatherSplitCandidates(bspbuild_t *build, bspworker_t *worker, bspline_t *list, splitcandidate_t *candidates)
+{
+	int		numcandidates = 0;
+	bspline_t	*l;
+
+	worker->markcount++;
+
+	for (l = list; l; l = l->next)
+	{
+		int	pair = l->planenum >> 1;
+		float	length = Length(l->line->v[1] - l->line->v[0]);
+
+		if (worker->planemarks[pair] == worker->markcount)
+		{
+			candidates[worker->planeslots[pair]].weight += length;
+			continue;
+		}
+
+		worker->planemarks[pair] = worker->markcount;
+		worker->planeslots[pair] = numcandidates;
+
+		// the first line on the plane decides which way it faces
+		candidates[numcandidates].planenum	= l->planenum;
+		candidates[numcandidates].order		= numcandidates;
+		candidates[numcandidates].weight	= length;
+		numcandidates++;
+	}
+
+	// favour long axial planes when sampling the candidates
+	if (build->maxcandidates > 0 && numcandidates > build->maxcandidates)
+	{
+		for (int i = 0; i < numcandidates; i++)
+		{
+			if (PlaneIsAxial(build, candidates[i].planenum))
+				candidates[i].weight *= 2.0f;
+		}
+
+		qsort(candidates, numcandidates, sizeof(splitcandidate_t), CompareCandidates);
+		numcandidates = build->maxcandidates;
+
+		// score the sampled planes in the order they were found so ties resolve the same way
+		qsort(candidates, numcandidates, sizeof(splitcandidate_t), CompareCandidateOrder);
+	}
+
+	return numcandidates;
+}
+
+// returns the number of the best plane
+template <class heuristic>
+static int SelectSplitPlane(bspbuild_t *build, bspworker_t *worker, bspline_t *list, int depth)
+{
+	bool			havebest = false;
+	float			bestscore = 0.0f;
+	int			bestplane = -1;
+	splitcandidate_t	*candidates;
+	int			numcandidates;
+	lineset_t		*lines = &worker->lineset;
+	splitinfo_t		info;
+
+	LineSet_Clear(lines);
+
+	for (bspline_t *l = list; l; l = l->next)
+		AddLine(build, lines, l);
+
+	info.numlines	= lines->numlines;
+	info.depth	= depth;
+
+	// the candidates are only needed until the plane is picked
+	arenamark_t mark = Arena_Mark(&worker->arena);
+	candidates = (splitcandidate_t*)Arena_Alloc(&worker->arena, lines->numlines * sizeof(splitcandidate_t));
+	numcandidates = GatherSplitCandidates(build, worker, list, candidates);
+	
+	for (int i = 0; i < numcandidates; i++)
+	{
+		float score;
+
+		info.axial = PlaneIsAxial(build, candidates[i].planenum);
+	
+		if (ScoreSplitPlane<heuristic>(build, lines, candidates[i].planenum, &info, havebest, bestscore, &score))
+		{
+			havebest	= true;
+			bestscore	= score;
+			bestplane	= candidates[i].planenum;
+		}
+	}
+
+	Arena_Rewind(&worker->arena, mark);
+	
+	return bestplane;
+}
+
+// when a worker is passed the changes to each side are recorded for ComputeSplitCounts
+static void PartitionLineList(bspbuild_t *build, arena_t *arena, int planenum, bspline_t *list, bspline_t **sides, bspworker_t *worker)
+{
+	sides[0] = NULL;
+	sides[1] = NULL;
+
+	if (worker)
+	{
+		for (int i = 0; i < 2; i++)
+		{
+			LineSet_Clear(&worker->removed[i]);
+			LineSet_Clear(&worker->added[i]);
+		}
+	}
+	
+	for (; list; list = list->next)
+	{
+		bspline_t *split[2];
+		int i;
+
+		SplitLine(build, arena, planenum, list, &split[0], &split[1]);
+
+		if (worker)
+		{
+			for (i = 0; i < 2; i++)
+			{
+				if (split[i] && split[i ^ 1])
+				{
+					AddLine(build, &worker->removed[i], list);
+					AddLine(build, &worker->added[i], split[i]);
+				}
+				else if (!split[i])
+				{
+					AddLine(build, &worker->removed[i], list);
+				}
+			}
+		}
+
+		// process the front (0) and back (1) splits
+		for (i = 0; i < 2; i++)
+		{
+			if (split[i])
+			{
+				split[i]->next = sides[i];
+				sides[i] = split[i];
+			}
+		}
+	}
+}
+
+// how the lines of a node fall on each distinct plane of its lines, counted
+// against the even plane of each pair. a child's counts are worked out from
+// its parent's by taking away the lines that didn't come down to it unchanged
+// and adding the split fragments that did, so when most lines stay on one
+// side the planes don't all need classifying again
+typedef struct splitcounts_s
+{
+	int	numlines;
+	int	numpairs;
+	int	*pairs;
+	int	(*sides)[4];
+
+} splitcounts_t;
+
+static void MarkSplitCounts(bspworker_t *worker, splitcounts_t *counts)
+{
+	worker->markcount++;
+
+	for (int i = 0; i < counts->numpairs; i++)
+	{
+		worker->planemarks[counts->pairs[i]] = worker->markcount;
+		worker->planeslots[counts->pairs[i]] = i;
+	}
+}
+
+// without a parent, or when too much changed, the planes are classified directly
+static splitcounts_t *ComputeSplitCounts(bspbuild_t *build, bspworker_t *worker, bspline_t *list, splitcounts_t *parent, const lineset_t *removed, const lineset_t *added)
+{
+	splitcounts_t	*counts;
+	int		numlines = 0;
+
+	for (bspline_t *l = list; l; l = l->next)
+		numlines++;
+
+	counts = (splitcounts_t*)Malloc(sizeof(splitcounts_t) + numlines * 5 * sizeof(int));
+	counts->numlines	= numlines;
+	counts->numpairs	= 0;
+	counts->sides		= (int(*)[4])(counts + 1);
+	counts->pairs		= (int*)(counts->sides + numlines);
+
+	memset(counts->sides, 0, numlines * sizeof(counts->sides[0]));
+
+	worker->markcount++;
+
+	for (bspline_t *l = list; l; l = l->next)
+	{
+		int pair = l->planenum >> 1;
+
+		if (worker->planemarks[pair] != worker->markcount)
+		{
+			worker->planemarks[pair] = worker->markcount;
+			counts->pairs[counts->numpairs++] = pair;
+		}
+	}
+
+	if (parent && removed->numlines + added->numlines < numlines)
+	{
+		MarkSplitCounts(worker, parent);
+
+		for (int i = 0; i < counts->numpairs; i++)
+		{
+			int	pair = counts->pairs[i];
+			int	removedsides[4] = { 0, 0, 0, 0 };
+
+			if (worker->planemarks[pair] != worker->markcount)
+				Error("ComputeSplitCounts: plane %i not in parent\n", pair);
+
+			ClassifyLines(build, removed, 0, removed->numlines, pair << 1, removedsides);
+			ClassifyLines(build, added, 0, added->numlines, pair << 1, counts->sides[i]);
+
+			for (int j = 0; j < 4; j++)
+				counts->sides[i][j] += parent->sides[worker->planeslots[pair]][j] - removedsides[j];
+		}
+	}
+	else
+	{
+		lineset_t *lines = &worker->lineset;
+
+		LineSet_Clear(lines);
+		for (bspline_t *l = list; l; l = l->next)
+			AddLine(build, lines, l);
+
+		for (int i = 0; i < counts->numpairs; i++)
+			ClassifyLines(build, lines, 0, lines->numlines, counts->pairs[i] << 1, counts->sides[i]);
+	}
+
+	return counts;
+}
+
+// picks the same plane as SelectSplitPlane without sampling, taking the side counts from the split counts
+template <class heuristic>
+static int SelectSplitPlaneFromCounts(bspbuild_t *build, bspworker_t *worker, bspline_t *list, splitcounts_t *counts, int depth)
+{
+	bool		havebest = false;
+	float		bestscore = 0.0f;
+	int		bestplane = -1;
+	splitinfo_t	info;
+
+	info.numlines	= counts->numlines;
+	info.depth	= depth;
+
+	MarkSplitCounts(worker, counts);
+
+	// score the planes in the order they first appear, facing the way the first line on them does
+	for (bspline_t *l = list; l; l = l->next)
+	{
+		int pair = l->planenum >> 1;
+
+		if (worker->planemarks[pair] != worker->markcount)
+			continue;
+
+		worker->planemarks[pair] = 0;
+
+		int	*sides = counts->sides[worker->planeslots[pair]];
+		int	flip = l->planenum & 1;
+
+		info.sides[PLANE_SIDE_FRONT]	= sides[PLANE_SIDE_FRONT ^ flip];
+		info.sides[PLANE_SIDE_BACK]	= sides[PLANE_SIDE_BACK ^ flip];
+		info.sides[PLANE_SIDE_ON]	= sides[PLANE_SIDE_ON];
+		info.sides[PLANE_SIDE_CROSS]	= sides[PLANE_SIDE_CROSS];
+		info.axial			= PlaneIsAxial(build, l->planenum);
+
+		float score = heuristic::Score(&info);
+
+		if (!havebest || score > bestscore)
+		{
+			havebest	= true;
+			bestscore	= score;
+			bestplane	= l->planenum;
+		}
+	}
+
+	return bestplane;
+}
+
+// subtrees with at least this many lines are handed to the thread pool
+#define	TASK_MIN_LINES		64
+
+typedef struct buildtask_s
+{
+	bsptree_t	*tree;
+	bspnode_t	*node;
+	bspline_t	*lines;
+	splitcounts_t	*counts;
+	int		depth;
+
+} buildtask_t;
+
+template <class heuristic>
+static void BuildTreeTask(threadpool_t *pool, int worker, void *data);
+
+static bool HasMinLines(bspline_t *lines, int minlines)
+{
+	for (; lines && minlines > 0; lines = lines->next)
+		minlines--;
+
+	return !minlines;
+}
+
+// takes ownership of the counts, which are NULL when they haven't been worked out yet
+template <class heuristic>
+static void BuildTreeRecursive(threadpool_t *pool, int worker, bsptree_t *tree, bspnode_t *node, bspline_t *lines, splitcounts_t *counts, int depth)
+{
+	bspbuild_t	*build = tree->build;
+	bspworker_t	*w = build->workers + worker;
+	int		planenum;
+	bspline_t	*sides[2];
+	splitcounts_t	*sidecounts[2];
+
+	if (!lines)
+		return;
+
+	arena_t *arena = &w->arena;
+
+	// sampling scores a different set of planes at each node so can't use the counts
+	if (build->maxcandidates > 0)
+	{
+		planenum = SelectSplitPlane<heuristic>(build, w, lines, depth);
+
+		PartitionLineList(build, arena, planenum, lines, sides, NULL);
+
+		sidecounts[0] = sidecounts[1] = NULL;
+	}
+	else
+	{
+		if (!counts)
+			counts = ComputeSplitCounts(build, w, lines, NULL, NULL, NULL);
+
+		planenum = SelectSplitPlaneFromCounts<heuristic>(build, w, lines, counts, depth);
+
+		PartitionLineList(build, arena, planenum, lines, sides, w);
+
+		for (int i = 0; i < 2; i++)
+		{
+			sidecounts[i] = NULL;
+			if (sides[i])
+				sidecounts[i] = ComputeSplitCounts(build, w, sides[i], counts, &w->removed[i], &w->added[i]);
+		}
+
+		free(counts);
+	}
+
+	node->plane = build->planes[planenum];
+	
+	// add two new nodes to the tree
+	node->children[0] = MallocBSPNode(arena, tree, node);
+	node->children[1] = MallocBSPNode(arena, tree, node);
+
+	// the two sides share nothing so a big back side can be built by another thread
+	if (pool && HasMinLines(sides[1], TASK_MIN_LINES))
+	{
+		buildtask_t *task = (buildtask_t*)Arena_Alloc(arena, sizeof(buildtask_t));
+
+		task->tree	= tree;
+		task->node	= node->children[1];
+		task->lines	= sides[1];
+		task->counts	= sidecounts[1];
+		task->depth	= depth + 1;
+
+		Thread_Spawn(pool, worker, BuildTreeTask<heuristic>, task);
+		BuildTreeRecursive<heuristic>(pool, worker, tree, node->children[0], sides[0], sidecounts[0], depth + 1);
+		return;
+	}
+	
+	// recurse down the front and back sides
+	BuildTreeRecursive<heuristic>(pool, worker, tree, node->children[0], sides[0], sidecounts[0], depth + 1);
+	BuildTreeRecursive<heuristic>(pool, worker, tree, node->children[1], sides[1], sidecounts[1], depth + 1);
+}
+
+template <class heuristic>
+static void BuildTreeTask(threadpool_t *pool, int worker, void *data)
+{
+	buildtask_t *task = (buildtask_t*)data;
+
+	BuildTreeRecursive<heuristic>(pool, worker, task->tree, task->node, task->lines, task->counts, task->depth);
+}
+
+// each heuristic gets its own copy of the builder with the scoring inlined
+template <class heuristic>
+static void BuildTreeWithHeuristic(bsptree_t *tree, bspline_t *lines, int numthreads)
+{
+	if (numthreads > 1)
+	{
+		buildtask_t *task = (buildtask_t*)BuildMalloc(tree->build, sizeof(buildtask_t));
+
+		task->tree	= tree;
+		task->node	= tree->root;
+		task->lines	= lines;
+		task->counts	= NULL;
+		task->depth	= 0;
+
+		Thread_Run(numthreads, BuildTreeTask<heuristic>, task);
+	}
+	else
+	{
+		BuildTreeRecursive<heuristic>(NULL, 0, tree, tree->root, lines, NULL, 0);
+	}
+}
+
+static void LinkNode(bsptree_t *tree, bspnode_t *node)
+{
+	node->next = tree->build->bspnodes;
+	tree->build->bspnodes = node;
+
+	node->treenext = tree->nodes;
+	tree->nodes = node;
+	tree->numnodes++;
+}
+
+// links the nodes into the build, tree and leaf lists in the order a serial
+// build creates them, so the lists don't depend on how the work was shared out
+static void LinkTreeNodes(bsptree_t *tree, bspnode_t *node)
+{
+	if (!node->children[0])
+	{
+		node->leafnext = tree->leafs;
+		tree->leafs = node;
+
+		tree->numleafs++;
+		return;
+	}
+
+	LinkNode(tree, node->children[0]);
+	LinkNode(tree, node->children[1]);
+
+	LinkTreeNodes(tree, node->children[0]);
+	LinkTreeNodes(tree, node->children[1]);
+}
+
+static bspline_t *MakeLineList(bspbuild_t *build)
+{
+	bspline_t	*list = NULL;
+	vec2		*vertices = build->vertices;
+	linedef_t	*linedefs = build->linedefs;
+
+	// every linedef adds at most one pair of planes
+	InitPlanes(build, (build->numlinedefs + 1) * 2);
+
+	for (int i = 0; i < build->numlinedefs; i++)
+	{
+		line_t *line = Line_Alloc(&build->arena);
+
+		line->v[0][0] = vertices[linedefs[i].vertices[0]][0];
+		line->v[0][1] = vertices[linedefs[i].vertices[0]][1];
+		line->v[1][0] = vertices[linedefs[i].vertices[1]][0];
+		line->v[1][1] = vertices[linedefs[i].vertices[1]][1];
+
+		//printf("line %i, %f, %f, %f, %f\n",
+		//	i,
+		//	line->v[0][0],
+		//	line->v[0][1],
+		//	line->v[1][0],
+		//	line->v[1][1]);
+
+		bspline_t *bspline = MallocBSPLine(&build->arena, line);
+
+		if (build->exact)
+		{
+			int v[4];
+
+			for (int j = 0; j < 4; j++)
+			{
+				float f = line->v[j >> 1][j & 1];
+
+				// leave headroom so the products in the plane tests fit in 64 bits
+				if (f != floorf(f) || f < -32768.0f || f > 32767.0f)
+					Error("MakeLineList: linedef %i isn't on the integer grid\n", i);
+
+				v[j] = (int)f;
+			}
+
+			// a zero length line has no plane and can't split anything
+			if (v[0] == v[2] && v[1] == v[3])
+				continue;
+
+			bspline->fixed = (fixedline_t*)Arena_Alloc(&build->arena, sizeof(fixedline_t));
+
+			for (int j = 0; j < 4; j++)
+				bspline->fixed->v[j >> 1][j & 1] = v[j] * FRACUNIT;
+
+			bspline->planenum = FindExactPlane(build, v[0], v[1], v[2], v[3]);
+		}
+		else
+		{
+			bspline->planenum = FindPlane(build, Line_Plane(line));
+		}
+
+		bspline->next = list;
+		list = bspline;
+	}
+
+	return list;
+}
+
+static bsptree_t *MakeEmptyTree(bspbuild_t *build)
+{
+	bsptree_t	*tree;
+	
+	tree = MallocTree(build);
+	tree->build = build;
+	tree->root = MallocBSPNode(&build->arena, tree, NULL);
+
+	return tree;
+}
+
+static int CompileNodeRecursive(bsptree_t *tree, bspnode_t *node)
+{
+	if (!node->children[0])
+	{
+		int leafnum = tree->numcleafs++;
+
+		tree->cleafs[leafnum].node = node;
+		node->leafnum = leafnum;
+
+		return ~leafnum;
+	}
+
+	int nodenum = tree->numcnodes++;
+	bspcnode_t *c = tree->cnodes + nodenum;
+
+	node->leafnum = -1;
+
+	c->plane = node->plane;
+	c->children[0] = CompileNodeRecursive(tree, node->children[0]);
+	c->children[1] = CompileNodeRecursive(tree, node->children[1]);
+
+	return nodenum;
+}
+
+// flatten the tree depth first so the front child of a node always follows it
+static void CompileTree(bsptree_t *tree)
+{
+	int numleafs = tree->numleafs;
+	int numnodes = tree->numnodes - numleafs;
+
+	tree->numcnodes	= 0;
+	tree->cnodes	= (bspcnode_t*)BuildMalloc(tree->build, numnodes * sizeof(bspcnode_t));
+	tree->numcleafs	= 0;
+	tree->cleafs	= (bspleaf_t*)BuildMalloc(tree->build, numleafs * sizeof(bspleaf_t));
+
+	tree->headnode = CompileNodeRecursive(tree, tree->root);
+}
+
+static void BoundTree(bsptree_t *tree);
+
+bsptree_t *BuildTree(bspbuild_t *build)
+{
+	bspline_t *lines = MakeLineList(build);
+
+	bsptree_t *tree = MakeEmptyTree(build);
+
+	int numthreads = build->numthreads > 1 ? build->numthreads : 1;
+
+	// the workers' arenas and selection scratch, indexed by plane pair
+	build->numworkers = numthreads;
+	build->workers = (bspworker_t*)BuildMalloc(build, numthreads * sizeof(bspworker_t));
+
+	for (int i = 0; i < numthreads; i++)
+	{
+		build->workers[i].planemarks = (int*)BuildMalloc(build, (build->maxplanes / 2) * sizeof(int));
+		build->workers[i].planeslots = (int*)BuildMalloc(build, (build->maxplanes / 2) * sizeof(int));
+	}
+
+	switch (build->heuristic)
+	{
+	case SPLIT_BALANCE:
+		BuildTreeWithHeuristic<BalanceHeuristic>(tree, lines, numthreads);
+		break;
+	case SPLIT_AXIAL:
+		BuildTreeWithHeuristic<AxialHeuristic>(tree, lines, numthreads);
+		break;
+	case SPLIT_DEPTH:
+		BuildTreeWithHeuristic<DepthHeuristic>(tree, lines, numthreads);
+		break;
+	default:
+		BuildTreeWithHeuristic<MinSplitsHeuristic>(tree, lines, numthreads);
+		break;
+	}
+
+	for (int i = 0; i < numthreads; i++)
+	{
+		bspworker_t *w = build->workers + i;
+
+		LineSet_Free(&w->lineset);
+		for (int j = 0; j < 2; j++)
+		{
+			LineSet_Free(&w->removed[j]);
+			LineSet_Free(&w->added[j]);
+		}
+	}
+
+	LinkNode(tree, tree->root);
+	LinkTreeNodes(tree, tree->root);
+
+	CompileTree(tree);
+	BoundTree(tree);
+
+	build->tree = tree;
+
+	return tree;
+}
+
+// ______________________________________________
+// leaf polygons
+
+// leaf polygons start out as a square this far from the origin on each side
+#define	WORLD_SIZE		16384.0f
+
+static polygon_t *MakeFullPolygon()
+{
+	polygon_t *p = Polygon_Alloc(4);
+	float s = WORLD_SIZE;
+
+	p->vertices[0][0]	=  -s;
+	p->vertices[0][1]	=  -s;
+	p->vertices[1][0]	=   s;
+	p->vertices[1][1]	=  -s;
+	p->vertices[2][0]	=   s;
+	p->vertices[2][1]	=   s;
+	p->vertices[3][0]	=  -s;
+	p->vertices[3][1]	=   s;
+	p->numvertices		= 4;
+
+	return p;
+}
+
+// the back side of nodes down to this depth is handed to another thread
+#define	LEAF_TASK_DEPTH		8
+
+typedef struct leaftask_s
+{
+	bsptree_t	*tree;
+	int		nodenum;
+	int		depth;
+	polygon_t	*p;
+	polygon_t	**polygons;
+
+} leaftask_t;
+
+static void SplitPolygonTask(threadpool_t *pool, int worker, void *data);
+
+// split the node's region between its children, each plane is applied once
+// for the node rather than once for every leaf beneath it. every leaf has its
+// own slot so threads never write to the same place
+static void SplitPolygonIntoLeafs(threadpool_t *pool, int worker, bsptree_t *tree, int nodenum, int depth, polygon_t *p, polygon_t **polygons)
+{
+	while (nodenum >= 0)
+	{
+		bspcnode_t	*n = tree->cnodes + nodenum;
+		polygon_t	*f = NULL, *b = NULL;
+
+		// the region might have been completely clipped away
+		if (p)
+		{
+			Polygon_SplitWithPlane(p, n->plane, tree->build->epsilon, &f, &b);
+			Polygon_Free(p);
+		}
+
+		if (pool && depth < LEAF_TASK_DEPTH && n->children[1] >= 0)
+		{
+			leaftask_t *task = (leaftask_t*)Arena_Alloc(&tree->build->workers[worker].arena, sizeof(leaftask_t));
+
+			task->tree	= tree;
+			task->nodenum	= n->children[1];
+			task->depth	= depth + 1;
+			task->p		= b;
+			task->polygons	= polygons;
+
+			Thread_Spawn(pool, worker, SplitPolygonTask, task);
+		}
+		else
+		{
+			SplitPolygonIntoLeafs(pool, worker, tree, n->children[1], depth + 1, b, polygons);
+		}
+
+		nodenum = n->children[0];
+		p = f;
+		depth++;
+	}
+
+	polygons[~nodenum] = p;
+}
+
+static void SplitPolygonTask(threadpool_t *pool, int worker, void *data)
+{
+	leaftask_t *task = (leaftask_t*)data;
+
+	SplitPolygonIntoLeafs(pool, worker, task->tree, task->nodenum, task->depth, task->p, task->polygons);
+}
+
+// the regions are split on the build's threads
+static void MakeLeafPolygons(bsptree_t *tree, polygon_t **polygons)
+{
+	bspbuild_t	*build = tree->build;
+	leaftask_t	*task;
+
+	if (build->numworkers > 1)
+	{
+		task = (leaftask_t*)BuildMalloc(build, sizeof(leaftask_t));
+
+		task->tree	= tree;
+		task->nodenum	= tree->headnode;
+		task->depth	= 0;
+		task->p		= MakeFullPolygon();
+		task->polygons	= polygons;
+
+		Thread_Run(build->numworkers, SplitPolygonTask, task);
+	}
+	else
+	{
+		SplitPolygonIntoLeafs(NULL, 0, tree, tree->headnode, 0, MakeFullPolygon(), polygons);
+	}
+}
+
+// ______________________________________________
+// bounds
+
+// split points are rounded and nearly flat regions are split off with the
+// build epsilon, so leaf bounds are pushed out a little past their polygons
+#define	BOUNDS_MARGIN		1.0f
+
+static box2 LeafBounds(bsptree_t *tree, polygon_t *p)
+{
+	box2	box = Polygon_BoundingBox(p);
+	float	edge = WORLD_SIZE - BOUNDS_MARGIN;
+
+	box.Expand(tree->build->epsilon + BOUNDS_MARGIN);
+
+	// the region carries on past the edge of the square it was clipped from
+	for (int i = 0; i < 2; i++)
+	{
+		if (box.min[i] <= -edge)
+			box.min[i] = -FLT_MAX;
+		if (box.max[i] >= edge)
+			box.max[i] = FLT_MAX;
+	}
+
+	return box;
+}
+
+static box2 *ChildBounds(bsptree_t *tree, int child)
+{
+	return child < 0 ? &tree->cleafs[~child].bounds : &tree->cbounds[child].bounds;
+}
+
+static box2 ChildSolidBounds(bsptree_t *tree, int child)
+{
+	box2 box;
+
+	if (child >= 0)
+		return tree->cbounds[child].solidbounds;
+
+	if (!tree->cleafs[~child].empty)
+		box = tree->cleafs[~child].bounds;
+
+	return box;
+}
+
+// children are always compiled after their parent, so walking the nodes
+// backwards sees the children first
+static void BoundSolids(bsptree_t *tree)
+{
+	for (int i = tree->numcnodes - 1; i >= 0; i--)
+	{
+		bspcnode_t	*n = tree->cnodes + i;
+		box2		box = ChildSolidBounds(tree, n->children[0]);
+
+		box.AddBox(ChildSolidBounds(tree, n->children[1]));
+		tree->cbounds[i].solidbounds = box;
+	}
+}
+
+static void BoundTree(bsptree_t *tree)
+{
+	polygon_t **polygons = (polygon_t**)BuildMalloc(tree->build, tree->numcleafs * sizeof(polygon_t*));
+
+	MakeLeafPolygons(tree, polygons);
+	tree->leafpolygons = polygons;
+
+	for (int i = 0; i < tree->numcleafs; i++)
+	{
+		tree->cleafs[i].bounds.Clear();
+
+		if (polygons[i])
+			tree->cleafs[i].bounds = LeafBounds(tree, polygons[i]);
+	}
+
+	tree->cbounds = (bspcbounds_t*)BuildMalloc(tree->build, tree->numcnodes * sizeof(bspcbounds_t));
+
+	for (int i = tree->numcnodes - 1; i >= 0; i--)
+	{
+		bspcnode_t	*n = tree->cnodes + i;
+		box2		box = *ChildBounds(tree, n->children[0]);
+
+		box.AddBox(*ChildBounds(tree, n->children[1]));
+		tree->cbounds[i].bounds = box;
+	}
+
+	// a leaf that was clipped away is a sliver along its parent's plane, so
+	// it gets the bounds of its parent
+	for (int i = 0; i < tree->numcnodes; i++)
+	{
+		for (int j = 0; j < 2; j++)
+		{
+			box2 *box = ChildBounds(tree, tree->cnodes[i].children[j]);
+
+			if (box->InsideOut())
+				*box = tree->cbounds[i].bounds;
+		}
+	}
+
+	BoundSolids(tree);
+}
+
+// ______________________________________________
+// empty leafs
+
+// if the line sits on the plane then  send the plane down the front or back side depending on whether the line normal
+// faces the same direction as the plane
+static void FilterLineIntoLeaf(bsptree_t *tree, int nodenum, line_t *l)
+{
+	bspbuild_t *build = tree->build;
+
+	while (nodenum >= 0)
+	{
+		bspcnode_t *n = tree->cnodes + nodenum;
+
+		int side = Line_OnPlaneSide(l, n->plane, build->epsilon);
+
+		if (side == PLANE_SIDE_FRONT)
+			nodenum = n->children[0];
+		else if (side == PLANE_SIDE_BACK)
+			nodenum = n->children[1];
+		else if (side == PLANE_SIDE_ON)
+		{
+			float dot = Dot(n->plane.GetNormal(), Line_GetNormal(l));
+
+			// map 1 to the front child and -1 to the back child
+			int facing = (dot > 0.0f ? 0 : 1);
+
+			nodenum = n->children[facing];
+		}
+		else
+		{
+			line_t *f, *b;
+			Line_SplitWithPlane(&build->arena, l, n->plane, build->epsilon, &f, &b);
+
+			FilterLineIntoLeaf(tree, n->children[0], f);
+			FilterLineIntoLeaf(tree, n->children[1], b);
+			return;
+		}
+	}
+
+	// this is a leaf
+	tree->cleafs[~nodenum].empty = true;
+}
+
+void MarkEmptyLeafs(bsptree_t *tree)
+{
+	bspbuild_t	*build = tree->build;
+	vec2		*vertices = build->vertices;
+	linedef_t	*linedefs = build->linedefs;
+
+	// filter all linedefs into the tree
+	for (int i = 0; i < build->numlinedefs; i++)
+	{
+		for (int j = 0; j < 2; j++)
+		{
+			if (linedefs[i].sidedefs[j] == -1)
+				continue;
+
+			// the line and its fragments are released once it has been filtered
+			arenamark_t mark = Arena_Mark(&build->arena);
+
+			// create a line for this linedef side
+			line_t *line = Line_Alloc(&build->arena);
+			line->v[0][0] = vertices[linedefs[i].vertices[j ^ 0]][0];
+			line->v[0][1] = vertices[linedefs[i].vertices[j ^ 0]][1];
+			line->v[1][0] = vertices[linedefs[i].vertices[j ^ 1]][0];
+			line->v[1][1] = vertices[linedefs[i].vertices[j ^ 1]][1];
+
+			// filter the line into the tree
+			FilterLineIntoLeaf(tree, tree->headnode, line);
+
+			Arena_Rewind(&build->arena, mark);
+		}
+	}
+
+	// copy the result back to the tree nodes
+	for (int i = 0; i < tree->numcleafs; i++)
+		tree->cleafs[i].node->empty = tree->cleafs[i].empty;
+
+	BoundSolids(tree);
+}
+
+// ______________________________________________
+// line query
+
+typedef struct linequery_s
+{
+	bsptree_t		*tree;
+	arena_t			arena;
+	linequerycallback_t	callback;
+	void			*data;
+
+} linequery_t;
+
+static void LineQueryRecursive(linequery_t *q, int nodenum, line_t *line)
+{
+	bsptree_t *tree = q->tree;
+
+	while (nodenum >= 0)
+	{
+		bspcnode_t *n = tree->cnodes + nodenum;
+
+		int side = Line_OnPlaneSide(line, n->plane, tree->build->epsilon);
+
+		if (side == PLANE_SIDE_FRONT)
+			nodenum = n->children[0];
+		else if (side == PLANE_SIDE_BACK)
+			nodenum = n->children[1];
+		else if (side == PLANE_SIDE_CROSS)
+		{
+			line_t *f, *b;
+			Line_SplitWithPlane(&q->arena, line, n->plane, tree->build->epsilon, &f, &b);
+
+			side = n->plane.PointOnPlaneSide(line->v[0], tree->build->epsilon);
+			if(side == PLANE_SIDE_FRONT)
+			{
+				LineQueryRecursive(q, n->children[0], f);
+				LineQueryRecursive(q, n->children[1], b);
+			}
+			else
+			{
+				LineQueryRecursive(q, n->children[1], b);
+				LineQueryRecursive(q, n->children[0], f);
+			}
+			return;
+		}
+		else
+		{
+			// hmmm	
+			nodenum = n->children[0];
+		}
+	}
+
+	q->callback(q->data, tree->cleafs[~nodenum].node, line->v[0]);
+}
+
+void LineQueryTree(bsptree_t *tree, line_t *line, linequerycallback_t callback, void *data)
+{
+	linequery_t	q;
+
+	q.tree		= tree;
+	q.callback	= callback;
+	q.data		= data;
+
+	// the split lines go in an arena of the query's own so queries can run
+	// on several threads at once
+	Arena_Init(&q.arena);
+
+	LineQueryRecursive(&q, tree->headnode, line);
+
+	Arena_Free(&q.arena);
+}
+
+// ______________________________________________
+// point location
+
+// points exactly on a plane go to the front like they do for traces
+int LocatePoint(bsptree_t *tree, vec2 p)
+{
+	int nodenum = tree->headnode;
+
+	while (nodenum >= 0)
+	{
+		bspcnode_t *n = tree->cnodes + nodenum;
+
+		nodenum = n->children[n->plane.PointOnPlaneSide(p, 0.0f) == PLANE_SIDE_BACK];
+	}
+
+	return ~nodenum;
+}
+
+// points walked down the tree together, each one step at a time so the node
+// loads and branches of different points overlap
+#define	LOCATE_POINTS		8
+
+void LocatePoints(bsptree_t *tree, const vec2 *points, int numpoints, int *leafnums)
+{
+	int	nodenums[LOCATE_POINTS];
+	vec2	p[LOCATE_POINTS];
+
+	for (int i = 0; i < numpoints; i += LOCATE_POINTS)
+	{
+		int count = numpoints - i < LOCATE_POINTS ? numpoints - i : LOCATE_POINTS;
+		int active = count;
+
+		for (int j = 0; j < count; j++)
+		{
+			nodenums[j] = tree->headnode;
+			p[j] = points[i + j];
+		}
+
+		while (active)
+		{
+			active = 0;
+
+			for (int j = 0; j < count; j++)
+			{
+				if (nodenums[j] < 0)
+					continue;
+
+				// the same test as PointOnPlaneSide with no epsilon, written
+				// out so the compiler can overlap the points
+				bspcnode_t *n = tree->cnodes + nodenums[j];
+				float d = (n->plane.a * p[j].x) + (n->plane.b * p[j].y) + n->plane.c;
+
+				nodenums[j] = n->children[d < 0.0f];
+				active += nodenums[j] >= 0;
+			}
+		}
+
+		for (int j = 0; j < count; j++)
+			leafnums[i + j] = ~nodenums[j];
+	}
+}
+
+// ______________________________________________
+// box queries
+
+typedef struct boxwork_s
+{
+	bsptree_t	*tree;
+	box2		box;
+	int		*leafnums;
+	int		maxleafs;
+	int		numleafs;
+
+} boxwork_t;
+
+static void BoxLeafnumsRecursive(boxwork_t *w, int nodenum)
+{
+	// the box can be on a child's side of every plane above it and still miss
+	// it, that's only worth checking when the walk splits
+	if (!w->box.IntersectsBox(*ChildBounds(w->tree, nodenum)))
+		return;
+
+	while (nodenum >= 0)
+	{
+		bspcnode_t	*n = w->tree->cnodes + nodenum;
+		int		side = n->plane.BoxOnPlaneSide(w->box, 0.0f);
+
+		// a box that only touches the plane stays on the side it's on
+		if (side == PLANE_SIDE_FRONT)
+			nodenum = n->children[0];
+		else if (side == PLANE_SIDE_BACK)
+			nodenum = n->children[1];
+		else
+		{
+			BoxLeafnumsRecursive(w, n->children[0]);
+			nodenum = n->children[1];
+
+			if (!w->box.IntersectsBox(*ChildBounds(w->tree, nodenum)))
+				return;
+		}
+	}
+
+	if (w->numleafs < w->maxleafs)
+		w->leafnums[w->numleafs] = ~nodenum;
+
+	w->numleafs++;
+}
+
+int BoxLeafnums(bsptree_t *tree, box2 box, int *leafnums, int maxleafs)
+{
+	boxwork_t	w;
+
+	w.tree		= tree;
+	w.box		= box;
+	w.leafnums	= leafnums;
+	w.maxleafs	= maxleafs;
+	w.numleafs	= 0;
+
+	BoxLeafnumsRecursive(&w, tree->headnode);
+
+	return w.numleafs;
+}
+
+// ______________________________________________
+// segment traces
+
+static void ClearTrace(bsptrace_t *trace, vec2 end)
+{
+	trace->hit	= false;
+	trace->fraction	= 1.0f;
+	trace->point	= end;
+	trace->leafnum	= -1;
+	trace->nodenum	= -1;
+	trace->plane	= plane_t(0.0f, 0.0f, 0.0f);
+}
+
+static void SetTraceHit(bsptree_t *tree, bsptrace_t *trace, vec2 start, vec2 end, float t, int leafnum, int entry, int entryside)
+{
+	trace->hit	= true;
+	trace->fraction	= t;
+	trace->point	= start + t * (end - start);
+	trace->leafnum	= leafnum;
+	trace->nodenum	= entry;
+
+	// the plane faces back along the segment
+	if (entry >= 0)
+		trace->plane = entryside ? -tree->cnodes[entry].plane : tree->cnodes[entry].plane;
+}
+
+// whether the part of a segment from t1 to t2, pushed out by radius, can
+// reach anything in the box
+static inline bool PartTouchesBox(const box2 &box, vec2 start, vec2 end, float t1, float t2, float radius)
+{
+	float x1 = start.x + t1 * (end.x - start.x);
+	float y1 = start.y + t1 * (end.y - start.y);
+	float x2 = start.x + t2 * (end.x - start.x);
+	float y2 = start.y + t2 * (end.y - start.y);
+
+	return
+		(x1 < x2 ? x1 : x2) - radius <= box.max.x &&
+		(x1 > x2 ? x1 : x2) + radius >= box.min.x &&
+		(y1 < y2 ? y1 : y2) - radius <= box.max.y &&
+		(y1 > y2 ? y1 : y2) + radius >= box.min.y;
+}
+
+// whether a subtree has anything solid near the part. a walk only looks when
+// its part changes, which is when it splits at a plane, so a subtree with no
+// solid leafs near the part is skipped without testing its planes
+static inline bool NearSolid(bsptree_t *tree, int nodenum, vec2 start, vec2 end, float t1, float t2, float radius)
+{
+	// a leaf is reached anyway
+	if (nodenum < 0)
+		return true;
+
+	return PartTouchesBox(tree->cbounds[nodenum].solidbounds, start, end, t1, t2, radius);
+}
+
+// the segment is start + t * (end - start), each call covers the part from t1
+// to t2 which is known to be on one side of every node above nodenum. entry
+// is the node whose plane the part crossed at t1, or -1 for the start
+static bool TraceRecursive(bsptree_t *tree, int nodenum, int entry, int entryside, float t1, float t2, vec2 start, vec2 end, bsptrace_t *trace)
+{
+	if (!NearSolid(tree, nodenum, start, end, t1, t2, 0.0f))
+		return false;
+
+	while (nodenum >= 0)
+	{
+		bspcnode_t	*n = tree->cnodes + nodenum;
+		plane_t		plane = n->plane;
+
+		// distance is linear along the segment so the ends are enough
+		float ds = (plane.a * start.x) + (plane.b * start.y) + plane.c;
+		float de = (plane.a * end.x) + (plane.b * end.y) + plane.c;
+		float d1 = ds + t1 * (de - ds);
+		float d2 = ds + t2 * (de - ds);
+
+		if (d1 >= 0.0f && d2 >= 0.0f)
+		{
+			nodenum = n->children[0];
+			continue;
+		}
+
+		if (d1 < 0.0f && d2 < 0.0f)
+		{
+			nodenum = n->children[1];
+			continue;
+		}
+
+		// the part crosses the plane, trace the near side first
+		int	side = d1 < 0.0f;
+		float	tmid = ds / (ds - de);
+
+		if (tmid < t1)
+			tmid = t1;
+		if (tmid > t2)
+			tmid = t2;
+
+		if (TraceRecursive(tree, n->children[side], entry, entryside, t1, tmid, start, end, trace))
+			return true;
+
+		entry		= nodenum;
+		entryside	= side;
+		nodenum		= n->children[side ^ 1];
+		t1		= tmid;
+
+		if (!NearSolid(tree, nodenum, start, end, t1, t2, 0.0f))
+			return false;
+	}
+
+	int leafnum = ~nodenum;
+
+	if (tree->cleafs[leafnum].empty)
+		return false;
+
+	SetTraceHit(tree, trace, start, end, t1, leafnum, entry, entryside);
+
+	return true;
+}
+
+bool TraceSegment(bsptree_t *tree, vec2 start, vec2 end, bsptrace_t *trace)
+{
+	ClearTrace(trace, end);
+
+	return TraceRecursive(tree, tree->headnode, -1, 0, 0.0f, 1.0f, start, end, trace);
+}
+
+#ifdef __SSE2__
+
+// four segments traced together. each lane has its own interval and entry
+// node, a lane drops out once it hits and the packet stops when all have
+typedef struct tracepacket_s
+{
+	bsptree_t	*tree;
+
+	__m128		sx, sy;
+	__m128		ex, ey;
+
+	vec2		start[4];
+	vec2		end[4];
+	bsptrace_t	*traces[4];
+
+	// lanes that have hit
+	int		done;
+
+} tracepacket_t;
+
+#define	M	-1
+static const int lanemasks[16][4] __attribute__((aligned(16))) =
+{
+	{ 0, 0, 0, 0 }, { M, 0, 0, 0 }, { 0, M, 0, 0 }, { M, M, 0, 0 },
+	{ 0, 0, M, 0 }, { M, 0, M, 0 }, { 0, M, M, 0 }, { M, M, M, 0 },
+	{ 0, 0, 0, M }, { M, 0, 0, M }, { 0, M, 0, M }, { M, M, 0, M },
+	{ 0, 0, M, M }, { M, 0, M, M }, { 0, M, M, M }, { M, M, M, M },
+};
+#undef M
+
+// without popcnt __builtin_popcount is a library call
+static const int lanecounts[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+static inline __m128 LaneMask(int lanes)
+{
+	return _mm_load_ps((const float*)lanemasks[lanes]);
+}
+
+static inline __m128 SelectLanes(int lanes, __m128 a, __m128 b)
+{
+	__m128 mask = LaneMask(lanes);
+
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static inline __m128i SelectLanes(int lanes, __m128i a, __m128i b)
+{
+	__m128i mask = _mm_castps_si128(LaneMask(lanes));
+
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// NearSolid for each lane, returns the lanes whose parts come near
+static inline int PacketNearSolid(tracepacket_t *pk, int nodenum, __m128 t1, __m128 t2)
+{
+	if (nodenum < 0)
+		return 15;
+
+	const box2	&box = pk->tree->cbounds[nodenum].solidbounds;
+	__m128		dx = _mm_sub_ps(pk->ex, pk->sx);
+	__m128		dy = _mm_sub_ps(pk->ey, pk->sy);
+
+	__m128 x1 = _mm_add_ps(pk->sx, _mm_mul_ps(t1, dx));
+	__m128 y1 = _mm_add_ps(pk->sy, _mm_mul_ps(t1, dy));
+	__m128 x2 = _mm_add_ps(pk->sx, _mm_mul_ps(t2, dx));
+	__m128 y2 = _mm_add_ps(pk->sy, _mm_mul_ps(t2, dy));
+
+	__m128 inx = _mm_and_ps(
+		_mm_cmple_ps(_mm_min_ps(x1, x2), _mm_set1_ps(box.max.x)),
+		_mm_cmpge_ps(_mm_max_ps(x1, x2), _mm_set1_ps(box.min.x)));
+	__m128 iny = _mm_and_ps(
+		_mm_cmple_ps(_mm_min_ps(y1, y2), _mm_set1_ps(box.max.y)),
+		_mm_cmpge_ps(_mm_max_ps(y1, y2), _mm_set1_ps(box.min.y)));
+
+	return _mm_movemask_ps(_mm_and_ps(inx, iny));
+}
+
+// finishes one lane on its own once the others have gone elsewhere
+static void TraceLane(tracepacket_t *pk, int nodenum, int lane, __m128 t1, __m128 t2, __m128i entry, __m128i entryside)
+{
+	float	t[2][4];
+	int	e[4], es[4];
+	int	i = lane == 1 ? 0 : lane == 2 ? 1 : lane == 4 ? 2 : 3;
+
+	_mm_storeu_ps(t[0], t1);
+	_mm_storeu_ps(t[1], t2);
+	_mm_storeu_si128((__m128i*)e, entry);
+	_mm_storeu_si128((__m128i*)es, entryside);
+
+	if (TraceRecursive(pk->tree, nodenum, e[i], es[i], t[0][i], t[1][i], pk->start[i], pk->end[i], pk->traces[i]))
+		pk->done |= lane;
+}
+
+// the same steps as TraceRecursive for each lane, every lane visits the parts
+// of its segment in the same order as a single trace would so the results
+// are identical
+static void TracePacketRecursive(tracepacket_t *pk, int nodenum, int active, __m128 t1, __m128 t2, __m128i entry, __m128i entryside)
+{
+	bsptree_t *tree = pk->tree;
+
+	active &= PacketNearSolid(pk, nodenum, t1, t2);
+
+	while (nodenum >= 0)
+	{
+		active &= ~pk->done;
+		if (!active)
+			return;
+
+		// a packet with one lane left is only overhead
+		if (lanecounts[active] == 1)
+		{
+			TraceLane(pk, nodenum, active, t1, t2, entry, entryside);
+			return;
+		}
+
+		bspcnode_t	*n = tree->cnodes + nodenum;
+		__m128		a = _mm_set1_ps(n->plane.a);
+		__m128		b = _mm_set1_ps(n->plane.b);
+		__m128		c = _mm_set1_ps(n->plane.c);
+		__m128		zero = _mm_setzero_ps();
+
+		__m128 ds = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, pk->sx), _mm_mul_ps(b, pk->sy)), c);
+		__m128 de = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, pk->ex), _mm_mul_ps(b, pk->ey)), c);
+		__m128 d1 = _mm_add_ps(ds, _mm_mul_ps(t1, _mm_sub_ps(de, ds)));
+		__m128 d2 = _mm_add_ps(ds, _mm_mul_ps(t2, _mm_sub_ps(de, ds)));
+
+		int front1 = _mm_movemask_ps(_mm_cmpge_ps(d1, zero));
+		int front2 = _mm_movemask_ps(_mm_cmpge_ps(d2, zero));
+		int onlyfront = active & front1 & front2;
+		int onlyback = active & ~(front1 | front2);
+		int cross = active & ~(onlyfront | onlyback);
+
+		if (!cross)
+		{
+			if (!onlyback)
+			{
+				nodenum = n->children[0];
+				continue;
+			}
+
+			if (!onlyfront)
+			{
+				nodenum = n->children[1];
+				continue;
+			}
+
+			// the lanes go separate ways
+			TracePacketRecursive(pk, n->children[0], onlyfront, t1, t2, entry, entryside);
+
+			nodenum	= n->children[1];
+			active	= onlyback;
+			continue;
+		}
+
+		__m128 tmid = _mm_div_ps(ds, _mm_sub_ps(ds, de));
+		tmid = _mm_min_ps(_mm_max_ps(tmid, t1), t2);
+
+		// the crossing lanes that start on each side. the packet goes to the
+		// near side of most of them first, the others have their near part
+		// traced on the other side and come back for their far part after
+		int near[2] = { cross & front1, cross & ~front1 };
+		int x = lanecounts[near[1]] > lanecounts[near[0]];
+		int y = x ^ 1;
+		int only[2] = { onlyfront, onlyback };
+
+		__m128i	node = _mm_set1_epi32(nodenum);
+
+		TracePacketRecursive(pk, n->children[x], only[x] | near[x], t1, SelectLanes(near[x], tmid, t2), entry, entryside);
+
+		if (near[y])
+		{
+			TracePacketRecursive(pk, n->children[y], only[y] | near[y] | near[x],
+				SelectLanes(near[x], tmid, t1),
+				SelectLanes(near[y], tmid, t2),
+				SelectLanes(near[x], node, entry),
+				SelectLanes(near[x], _mm_set1_epi32(x), entryside));
+
+			nodenum		= n->children[x];
+			active		= near[y];
+			t1		= tmid;
+			entry		= node;
+			entryside	= _mm_set1_epi32(y);
+		}
+		else
+		{
+			nodenum		= n->children[y];
+			active		= only[y] | near[x];
+			t1		= SelectLanes(near[x], tmid, t1);
+			entry		= SelectLanes(near[x], node, entry);
+			entryside	= SelectLanes(near[x], _mm_set1_epi32(x), entryside);
+		}
+
+		active &= PacketNearSolid(pk, nodenum, t1, t2);
+	}
+
+	int leafnum = ~nodenum;
+
+	active &= ~pk->done;
+	if (!active || tree->cleafs[leafnum].empty)
+		return;
+
+	float	t[4];
+	int	e[4], es[4];
+
+	_mm_storeu_ps(t, t1);
+	_mm_storeu_si128((__m128i*)e, entry);
+	_mm_storeu_si128((__m128i*)es, entryside);
+
+	for (int i = 0; i < 4; i++)
+	{
+		if (active & (1 << i))
+			SetTraceHit(tree, pk->traces[i], pk->start[i], pk->end[i], t[i], leafnum, e[i], es[i]);
+	}
+
+	pk->done |= active;
+}
+
+static void TracePacket(bsptree_t *tree, const vec2 *starts, const vec2 *ends, int numsegments, bsptrace_t *traces)
+{
+	tracepacket_t	pk;
+	float		sx[4], sy[4], ex[4], ey[4];
+
+	pk.tree = tree;
+	pk.done = 0;
+
+	for (int i = 0; i < 4; i++)
+	{
+		// unused lanes repeat the first segment and start out inactive
+		int j = i < numsegments ? i : 0;
+
+		pk.start[i]	= starts[j];
+		pk.end[i]	= ends[j];
+		pk.traces[i]	= traces + j;
+
+		sx[i] = starts[j].x;
+		sy[i] = starts[j].y;
+		ex[i] = ends[j].x;
+		ey[i] = ends[j].y;
+	}
+
+	pk.sx = _mm_loadu_ps(sx);
+	pk.sy = _mm_loadu_ps(sy);
+	pk.ex = _mm_loadu_ps(ex);
+	pk.ey = _mm_loadu_ps(ey);
+
+	TracePacketRecursive(&pk, tree->headnode, (1 << numsegments) - 1, _mm_setzero_ps(), _mm_set1_ps(1.0f), _mm_set1_epi32(-1), _mm_setzero_si128());
+}
+
+#endif
+
+void TraceSegments(bsptree_t *tree, const vec2 *starts, const vec2 *ends, int numsegments, bsptrace_t *traces)
+{
+	for (int i = 0; i < numsegments; i++)
+		ClearTrace(traces + i, ends[i]);
+
+#ifdef __SSE2__
+	for (int i = 0; i < numsegments; i += 4)
+		TracePacket(tree, starts + i, ends + i, numsegments - i < 4 ? numsegments - i : 4, traces + i);
+#else
+	for (int i = 0; i < numsegments; i++)
+		TraceRecursive(tree, tree->headnode, -1, 0, 0.0f, 1.0f, starts[i], ends[i], traces + i);
+#endif
+}
+
+// ______________________________________________
+// circle sweeps
+
+// contacts are backed off this far so the circle stops short of the plane
+#define	SWEEP_EPSILON		(1.0f / 32.0f)
+
+typedef struct sweepwork_s
+{
+	bsptree_t	*tree;
+	vec2		start;
+	vec2		end;
+	float		radius;
+	bspsweep_t	*sweep;
+
+} sweepwork_t;
+
+// the same walk as TraceRecursive with every plane pushed out by the radius
+// on both sides. a part of the path that passes within the radius of a plane
+// goes down both sides so, unlike a trace, a later part can hit before an
+// earlier one and the nearest hit is kept
+static void SweepRecursive(sweepwork_t *w, int nodenum, int entry, int entryside, float t1, float t2)
+{
+	bsptree_t	*tree = w->tree;
+	bspsweep_t	*sweep = w->sweep;
+	float		r = w->radius;
+
+	if (!NearSolid(tree, nodenum, w->start, w->end, t1, t2, r))
+		return;
+
+	while (nodenum >= 0)
+	{
+		// nothing past the nearest hit matters
+		if (sweep->hit && t1 >= sweep->fraction)
+			return;
+
+		bspcnode_t	*n = tree->cnodes + nodenum;
+		plane_t		plane = n->plane;
+
+		float ds = (plane.a * w->start.x) + (plane.b * w->start.y) + plane.c;
+		float de = (plane.a * w->end.x) + (plane.b * w->end.y) + plane.c;
+		float d1 = ds + t1 * (de - ds);
+		float d2 = ds + t2 * (de - ds);
+
+		if (d1 >= r && d2 >= r)
+		{
+			nodenum = n->children[0];
+			continue;
+		}
+
+		if (d1 < -r && d2 < -r)
+		{
+			nodenum = n->children[1];
+			continue;
+		}
+
+		// the near side lasts until the circle is clear of the plane and the
+		// far side starts once it touches it, both as fractions of the part
+		int	side;
+		float	nearfrac, farfrac;
+
+		if (d1 < d2)
+		{
+			float idist = 1.0f / (d1 - d2);
+
+			side		= 1;
+			nearfrac	= (d1 - r - SWEEP_EPSILON) * idist;
+			farfrac		= (d1 + r + SWEEP_EPSILON) * idist;
+		}
+		else if (d1 > d2)
+		{
+			float idist = 1.0f / (d1 - d2);
+
+			side		= 0;
+			nearfrac	= (d1 + r + SWEEP_EPSILON) * idist;
+			farfrac		= (d1 - r - SWEEP_EPSILON) * idist;
+		}
+		else
+		{
+			// parallel to the plane and within the radius of it
+			side		= 0;
+			nearfrac	= 1.0f;
+			farfrac		= 0.0f;
+		}
+
+		nearfrac = nearfrac < 0.0f ? 0.0f : nearfrac > 1.0f ? 1.0f : nearfrac;
+		farfrac = farfrac < 0.0f ? 0.0f : farfrac > 1.0f ? 1.0f : farfrac;
+
+		SweepRecursive(w, n->children[side], entry, entryside, t1, t1 + (t2 - t1) * nearfrac);
+
+		entry		= nodenum;
+		entryside	= side;
+		nodenum		= n->children[side ^ 1];
+		t1		= t1 + (t2 - t1) * farfrac;
+
+		if (!NearSolid(tree, nodenum, w->start, w->end, t1, t2, r))
+			return;
+	}
+
+	int leafnum = ~nodenum;
+
+	if (tree->cleafs[leafnum].empty)
+		return;
+
+	if (sweep->hit && t1 >= sweep->fraction)
+		return;
+
+	sweep->hit		= true;
+	sweep->fraction		= t1;
+	sweep->point		= w->start + t1 * (w->end - w->start);
+	sweep->leafnum		= leafnum;
+	sweep->nodenum		= entry;
+	sweep->startsolid	= entry < 0;
+
+	// the normal faces back along the path
+	if (entry >= 0)
+	{
+		plane_t		plane = tree->cnodes[entry].plane;
+		vec2		normal = plane.GetNormal();
+		float		d = (plane.a * w->start.x) + (plane.b * w->start.y) + plane.c;
+
+		sweep->normal = entryside ? -normal : normal;
+
+		// a contact right at the start may already be inside the radius
+		if (t1 == 0.0f && (entryside ? -d : d) < w->radius)
+			sweep->startsolid = true;
+	}
+}
+
+bool SweepCircle(bsptree_t *tree, vec2 start, vec2 end, float radius, bspsweep_t *sweep)
+{
+	sweepwork_t	w;
+
+	sweep->hit		= false;
+	sweep->startsolid	= false;
+	sweep->fraction		= 1.0f;
+	sweep->point		= end;
+	sweep->normal		= vec2(0.0f, 0.0f);
+	sweep->leafnum		= -1;
+	sweep->nodenum		= -1;
+
+	w.tree		= tree;
+	w.start		= start;
+	w.end		= end;
+	w.radius	= radius;
+	w.sweep		= sweep;
+
+	SweepRecursive(&w, tree->headnode, -1, 0, 0.0f, 1.0f);
+
+	return sweep->hit;
+}
+
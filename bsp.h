@@ -0,0 +1,283 @@
+#ifndef __BSP_H__
+#define __BSP_H__
+
+#include "vec2.h"
+#include "plane2.h"
+#include "box2.h"
+#include "polygon.h"
+#include "arena.h"
+#include "fixed.h"
+
+// ______________________________________________
+// lines
+
+typedef struct line_s
+{
+	vec2	v[2];
+
+} line_t;
+
+// ______________________________________________
+// map data
+
+typedef struct linedef_s
+{
+	int	vertices[2];
+	int	sidedefs[2];
+
+} linedef_t;
+
+// ______________________________________________
+// bsp tree
+
+// nodes
+typedef struct bspnode_s
+{
+	struct bspnode_s	*next;
+	struct bspnode_s	*treenext;
+	struct bspnode_s	*leafnext;
+	struct bspnode_s	*parent;
+	struct bspnode_s	*children[2];
+	struct bsptree_s	*tree;
+	
+	// the node split plane
+	plane_t			plane;
+	
+	bool			empty;
+
+	// index into the compiled leafs, -1 for nodes
+	int			leafnum;
+
+} bspnode_t;
+
+// compiled nodes
+// the finished tree is flattened depth first into an array of these for
+// queries, a negative child is a leaf and ~child is its index in the leafs
+typedef struct bspcnode_s
+{
+	plane_t			plane;
+	int			children[2];
+
+} bspcnode_t;
+
+typedef struct bspleaf_s
+{
+	bspnode_t		*node;
+	bool			empty;
+
+	// the leaf's region, unbounded on the sides that reach the edge of the world
+	box2			bounds;
+
+} bspleaf_t;
+
+// bounds kept alongside the compiled nodes so queries can skip whole subtrees
+typedef struct bspcbounds_s
+{
+	// every leaf beneath the node
+	box2			bounds;
+
+	// only the solid leafs, inside out if there are none
+	box2			solidbounds;
+
+} bspcbounds_t;
+
+// tree
+typedef struct bsptree_s
+{
+	struct bspbuild_s	*build;
+
+	bspnode_t	*nodes;
+	int		numnodes;
+	int		numleafs;
+	int		depth;
+	
+	bspnode_t	*root;
+	bspnode_t	*leafs;
+
+	plane_t		plane;
+
+	// the compiled tree, headnode is negative if the whole tree is one leaf
+	int		headnode;
+	int		numcnodes;
+	bspcnode_t	*cnodes;
+	int		numcleafs;
+	bspleaf_t	*cleafs;
+
+	// one for each compiled node
+	bspcbounds_t	*cbounds;
+
+	// the convex region of each compiled leaf, NULL if it was clipped away.
+	// they're made along with the tree and freed with the build
+	polygon_t	**leafpolygons;
+	
+} bsptree_t;
+
+// ______________________________________________
+// split heuristics
+
+enum
+{
+	SPLIT_MINSPLITS,	// fewest split lines
+	SPLIT_BALANCE,		// as many lines in front of the plane as behind
+	SPLIT_AXIAL,		// fewest split lines, preferring axial planes
+	SPLIT_DEPTH,		// balance near the root, fewest splits further down
+	NUM_SPLIT_HEURISTICS
+};
+
+// returns -1 if there's no heuristic with the name
+int FindSplitHeuristic(const char *name);
+const char *SplitHeuristicName(int heuristic);
+
+// ______________________________________________
+// build context
+
+// a build owns the map data and everything allocated while building and
+// querying its tree. builds share no state so several can run at once on
+// different threads, and a build can be reset and reused for another map.
+// a single build can also split its tree across numthreads threads
+typedef struct bspbuild_s
+{
+	float			epsilon;
+
+	// when non zero only the longest candidate planes are scored at each node,
+	// which bounds the cost of selecting a split plane on large maps
+	int			maxcandidates;
+
+	// how split planes are scored, one of SPLIT_*
+	int			heuristic;
+
+	// threads used to build the tree, the output doesn't depend on the count
+	int			numthreads;
+
+	// split with integer plane tests on fixed point lines instead of float
+	// epsilon tests. exact trees differ from float trees but don't depend on
+	// the compiler or float rounding, map coordinates must be integers
+	bool			exact;
+
+	int			numvertices;
+	vec2			*vertices;
+	int			numlinedefs;
+	linedef_t		*linedefs;
+
+	// list of all the bsp nodes allocated for the map
+	bspnode_t		*bspnodes;
+
+	// distinct line planes, stored in pairs with the opposite facing plane at planenum ^ 1
+	int			numplanes;
+	int			maxplanes;
+	plane_t			*planes;
+	exactplane_t		*exactplanes;		// only for exact builds
+	int			*planehash;
+	int			*planechain;
+
+	// per thread state while building the tree
+	int			numworkers;
+	struct bspworker_s	*workers;
+
+	bsptree_t		*tree;
+
+	// memory owned by the build, threads building the tree allocate from their own arenas
+	arena_t			arena;
+
+} bspbuild_t;
+
+bspbuild_t *AllocBuild();
+void FreeBuild(bspbuild_t *build);
+
+// frees everything allocated by the build, keeping the build settings
+void ResetBuild(bspbuild_t *build);
+
+// returns zeroed memory that lives until the build is reset or freed, not thread safe
+void *BuildMalloc(bspbuild_t *build, int numbytes);
+
+// copies the map data into the build
+void SetMapData(bspbuild_t *build, const vec2 *vertices, int numvertices, const linedef_t *linedefs, int numlinedefs);
+
+bsptree_t *BuildTree(bspbuild_t *build);
+void MarkEmptyLeafs(bsptree_t *tree);
+
+
+// walk the line through the tree, calling back for each leaf it passes through
+// in order along with the point where the line enters the leaf
+typedef void (*linequerycallback_t)(void *data, bspnode_t *leaf, vec2 p);
+void LineQueryTree(bsptree_t *tree, line_t *line, linequerycallback_t callback, void *data);
+
+// returns the compiled leaf containing the point, tree->cleafs[leafnum].empty
+// says whether it's open space
+int LocatePoint(bsptree_t *tree, vec2 p);
+
+// the same for an array of points, which is faster than one at a time
+void LocatePoints(bsptree_t *tree, const vec2 *points, int numpoints, int *leafnums);
+
+// finds every compiled leaf the box overlaps, writing up to maxleafs of them to
+// leafnums. returns how many there were in total, which is more than maxleafs
+// if the buffer was too small
+int BoxLeafnums(bsptree_t *tree, box2 box, int *leafnums, int maxleafs);
+
+// the first solid leaf a segment enters
+typedef struct bsptrace_s
+{
+	bool		hit;
+
+	// how far along the segment the hit is, 1 if there's no hit
+	float		fraction;
+	vec2		point;
+	int		leafnum;
+
+	// the compiled node whose plane was hit and the plane facing back toward
+	// the start, -1 if the start is already in a solid leaf
+	int		nodenum;
+	plane_t		plane;
+
+} bsptrace_t;
+
+// casts the segment through the compiled tree, returning true if it hits a
+// solid leaf. a trace doesn't allocate or change the tree so any number can
+// run at once
+bool TraceSegment(bsptree_t *tree, vec2 start, vec2 end, bsptrace_t *trace);
+
+// traces a batch of segments, four at a time through the tree together, with
+// the same results as tracing them one by one. segments that start close
+// together and point the same way, like a fan of shots, share most of their
+// path and trace about twice as fast. unrelated segments go their own ways
+// near the root and gain nothing
+void TraceSegments(bsptree_t *tree, const vec2 *starts, const vec2 *ends, int numsegments, bsptrace_t *traces);
+
+// the first contact of a circle moving along a segment
+typedef struct bspsweep_s
+{
+	bool		hit;
+
+	// the circle overlaps a solid leaf where it starts
+	bool		startsolid;
+
+	// how far along the segment the circle stops and its center there
+	float		fraction;
+	vec2		point;
+
+	// the normal of the plane it stopped against, facing back along the path
+	vec2		normal;
+
+	// the solid leaf and the compiled node whose plane was hit
+	int		leafnum;
+	int		nodenum;
+
+} bspsweep_t;
+
+// sweeps a circle from start to end through the compiled tree, returning true
+// if it touches a solid leaf. each plane is pushed out by the radius so the
+// contact is conservative around sharp corners. like traces, sweeps don't
+// allocate and any number can run at once
+bool SweepCircle(bsptree_t *tree, vec2 start, vec2 end, float radius, bspsweep_t *sweep);
+
+// ______________________________________________
+// line functions
+
+line_t *Line_Alloc(arena_t *arena);
+line_t *Line_Copy(arena_t *arena, line_t *s);
+int Line_OnPlaneSide(line_t *l, plane_t plane, float epsilon);
+void Line_SplitWithPlane(arena_t *arena, line_t *l, plane_t plane, float epsilon, line_t **f, line_t **b);
+vec2 Line_GetNormal(line_t *l);
+plane_t Line_Plane(line_t *l);
+
+#endif
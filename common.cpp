@@ -0,0 +1,65 @@
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <memory.h>
+#include "common.h"
+
+// ______________________________________________
+// errors and warnings
+
+void Error(const char *error, ...)
+{
+	va_list valist;
+	char buffer[2048];
+	
+	va_start(valist, error);
+	vsprintf(buffer, error, valist);
+	va_end(valist);
+	
+	fprintf(stderr, "\x1b[31m");
+	fprintf(stderr, "Error: %s", buffer);
+	fprintf(stderr, "\x1b[0m");
+	exit(1);
+}
+
+void Warning(const char *warning, ...)
+{
+	va_list valist;
+	char buffer[2048];
+	
+	va_start(valist, warning);
+	vsprintf(buffer, warning, valist);
+	va_end(valist);
+	
+	fprintf(stderr, "\x1b[33m");
+	fprintf(stderr, "Warning: %s", buffer);
+	fprintf(stderr, "\x1b[0m");
+}
+
+// ______________________________________________
+// Memory allocation
+
+void *Malloc(int numbytes)
+{
+	void *mem;
+	
+	mem = malloc(numbytes);
+
+	if (!mem)
+	{
+		Error("Malloc: Failed to allocated memory");
+	}
+
+	return mem;
+}
+
+void *MallocZeroed(int numbytes)
+{
+	void *mem;
+	
+	mem = Malloc(numbytes);
+
+	memset(mem, 0, numbytes);
+
+	return mem;
+}
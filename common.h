@@ -0,0 +1,12 @@
+#ifndef __COMMON_H__
+#define __COMMON_H__
+
+// errors and warnings
+void Error(const char *error, ...);
+void Warning(const char *warning, ...);
+
+// memory allocation
+void *Malloc(int numbytes);
+void *MallocZeroed(int numbytes);
+
+#endif
@@ -4,170 +4,862 @@
 #include <stdio.h>
 #include <string.h>
 
+// memory mapped lump access is used on posix systems, everything else goes
+// through the stdio path
+#if defined(__unix__) || defined(__APPLE__)
+#define DOOM_USE_MMAP
+#endif
+
+#ifdef DOOM_USE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 // internal structures
 typedef struct
 {
-    FILE	*fp;
-    char        name[8];
-    int         filepos;
-    int         size;
-} lumpinfo_t;
+	FILE		*fp;
+	unsigned char	*mapbase;	// mapped file contents or NULL if the file is read with stdio
+	long		mapsize;
+} wadfile_t;
 
-#define MAX_LUMPS	32 * 1024
-#define MAX_FILES	 1 * 1024
+typedef struct
+{
+	wadfile_t	*file;
+	char		name[8];
+	int		filepos;
+	int		size;
+	int		next;		// next lump in the same hash chain
+
+	// lump cache
+	bool		cached;		// lump data is resident and counted in the cache size
+	int		pins;		// locked lumps are never evicted
+	int		lruprev;	// towards the most recently used lump
+	int		lrunext;	// towards the least recently used lump
+} lumpinfo_t;
 
-// internal lump data
-static int		numlumps;
-static lumpinfo_t	lumpdir[MAX_LUMPS];
-static void		*lumpdata[MAX_LUMPS];
-static int		numfiles;
-static FILE		*files[MAX_FILES];
+struct wad_s
+{
+	// open files, closed files leave a NULL slot so file numbers stay valid
+	int		numfiles;
+	int		maxfiles;
+	wadfile_t	**files;
+
+	// lump directory
+	int		numlumps;
+	int		maxlumps;
+	lumpinfo_t	*lumpdir;
+	void		**lumpdata;
+
+	// lump name hash, chains are linked newest first so later files override earlier ones
+	int		numhashchains;
+	int		*lumphash;
+
+	// map marker lumps in the order they were first seen, hashed by name
+	int		nummaps;
+	int		maxmaps;
+	int		*maplumps;
+	int		*mapnext;
+	int		nummapchains;
+	int		*maphash;
+
+	// lump cache, 0 bytes means no budget
+	long		cachebudget;
+	long		cachesize;
+	int		lruhead;
+	int		lrutail;
+};
+
+// the wad used by the Doom_ interface
+static wad_t		*defaultwad;
 
 static void *Doom_Malloc(int numbytes)
 {
 	return malloc(numbytes);
 }
 
-static int Doom_AddLump(char name[8], FILE *fp, int filepos, int size)
+static void *Doom_Realloc(void *p, int numbytes)
+{
+	void *mem;
+
+	mem = realloc(p, numbytes);
+
+	if (!mem)
+	{
+		printf("Failed to allocate wad memory\n");
+		exit(-1);
+	}
+
+	return mem;
+}
+
+// copy a lump name into an 8 character upper case key, padded with zeros
+static void Doom_NameKey(char key[8], const char *name)
+{
+	int	i;
+
+	for (i = 0; i < 8 && name[i]; i++)
+		key[i] = (name[i] >= 'a' && name[i] <= 'z') ? name[i] - ('a' - 'A') : name[i];
+	for (; i < 8; i++)
+		key[i] = 0;
+}
+
+static unsigned int Doom_HashKey(const char key[8])
+{
+	unsigned int	hash = 2166136261u;
+
+	for (int i = 0; i < 8 && key[i]; i++)
+		hash = (hash ^ (unsigned char)key[i]) * 16777619u;
+
+	return hash;
+}
+
+// ______________________________________________
+// lump hash
+
+static int Wad_FindLump(wad_t *wad, const char key[8])
+{
+	int	i;
+
+	for (i = wad->lumphash[Doom_HashKey(key) & (wad->numhashchains - 1)]; i >= 0; i = wad->lumpdir[i].next)
+	{
+		if (!memcmp(key, wad->lumpdir[i].name, 8))
+			return i;
+	}
+
+	return -1;
+}
+
+static void Wad_HashLump(wad_t *wad, int lumpnum)
+{
+	lumpinfo_t	*lumpinfo = wad->lumpdir + lumpnum;
+	unsigned int	hash;
+
+	// link into the front of the hash chain so the newest lump is found first
+	hash			= Doom_HashKey(lumpinfo->name) & (wad->numhashchains - 1);
+	lumpinfo->next		= wad->lumphash[hash];
+	wad->lumphash[hash]	= lumpnum;
+}
+
+// rebuild the hash chains, growing them to keep the chains short
+static void Wad_RehashLumps(wad_t *wad)
+{
+	int	numchains;
+
+	for (numchains = 64; numchains < wad->maxlumps; numchains <<= 1)
+		;
+
+	if (numchains != wad->numhashchains)
+	{
+		wad->lumphash		= (int*)Doom_Realloc(wad->lumphash, numchains * sizeof(int));
+		wad->numhashchains	= numchains;
+	}
+
+	memset(wad->lumphash, -1, wad->numhashchains * sizeof(int));
+
+	for (int i = 0; i < wad->numlumps; i++)
+		Wad_HashLump(wad, i);
+}
+
+static int Wad_AddLump(wad_t *wad, const char name[8], wadfile_t *file, int filepos, int size)
 {
 	lumpinfo_t	*lumpinfo;
 
+	// grow the lump directory
+	if (wad->numlumps == wad->maxlumps)
+	{
+		int oldmax = wad->maxlumps;
+
+		wad->maxlumps	= oldmax ? oldmax * 2 : 1024;
+		wad->lumpdir	= (lumpinfo_t*)Doom_Realloc(wad->lumpdir, wad->maxlumps * sizeof(lumpinfo_t));
+		wad->lumpdata	= (void**)Doom_Realloc(wad->lumpdata, wad->maxlumps * sizeof(void*));
+
+		memset(wad->lumpdata + oldmax, 0, (wad->maxlumps - oldmax) * sizeof(void*));
+	}
+
 	// allocate an entry from the lump directory
-	lumpinfo = lumpdir + numlumps;
-	numlumps++;
+	lumpinfo = wad->lumpdir + wad->numlumps;
+	wad->numlumps++;
 
-	lumpinfo->fp        	= fp;
+	lumpinfo->file		= file;
 	lumpinfo->filepos	= filepos;
 	lumpinfo->size		= size;
-	strncpy(lumpinfo->name, name, 8);
-
-	return numlumps - 1;
+	lumpinfo->cached	= false;
+	lumpinfo->pins		= 0;
+	lumpinfo->lruprev	= -1;
+	lumpinfo->lrunext	= -1;
+	Doom_NameKey(lumpinfo->name, name);
+
+	if (wad->numlumps > wad->numhashchains)
+		Wad_RehashLumps(wad);
+	else
+		Wad_HashLump(wad, wad->numlumps - 1);
+
+	return wad->numlumps - 1;
 }
-	
 
-// actually read the bytes of the lump
-static void Doom_ReadLump(int lumpnum)
+static bool Wad_LumpIs(wad_t *wad, int lumpnum, const char *name)
 {
-	lumpinfo_t	*lumpinfo;
+	char	key[8];
 
-	lumpinfo = lumpdir + lumpnum;
+	if (lumpnum < 0 || lumpnum >= wad->numlumps)
+		return false;
 
-	// don't load the lump if it's already been loaded or if it has zero size
-	if(lumpdata[lumpnum])
-		return;
-	if(!lumpinfo->size)
-		return;
+	Doom_NameKey(key, name);
 
-	// allocate memory for the lump
-	lumpdata[lumpnum] = Doom_Malloc(lumpinfo->size);
+	return !memcmp(key, wad->lumpdir[lumpnum].name, 8);
+}
 
-	// read the lump data
-	fseek(lumpinfo->fp, lumpinfo->filepos, SEEK_SET);
-	fread(lumpdata[lumpnum], sizeof(unsigned char), lumpinfo->size, lumpinfo->fp);
+// ______________________________________________
+// map index
+
+// a map is a zero sized marker lump followed by the map data lumps
+static bool Wad_IsMapMarker(wad_t *wad, int lumpnum)
+{
+	return
+		wad->lumpdir[lumpnum].size == 0 &&
+		Wad_LumpIs(wad, lumpnum + THINGS_OFFSET, "THINGS") &&
+		Wad_LumpIs(wad, lumpnum + LINEDEFS_OFFSET, "LINEDEFS") &&
+		Wad_LumpIs(wad, lumpnum + VERTICES_OFFSET, "VERTEXES");
 }
 
-int Doom_LumpLength(int lumpnum)
+static int Wad_FindMap(wad_t *wad, const char key[8])
 {
-	lumpinfo_t *l = lumpdir + lumpnum;
+	int	i;
+
+	if (!wad->nummaps)
+		return -1;
+
+	for (i = wad->maphash[Doom_HashKey(key) & (wad->nummapchains - 1)]; i >= 0; i = wad->mapnext[i])
+	{
+		if (!memcmp(key, wad->lumpdir[wad->maplumps[i]].name, 8))
+			return i;
+	}
 
-	return l->size;
+	return -1;
 }
 
-void *Doom_LumpFromNum(int lumpnum)
+static void Wad_HashMap(wad_t *wad, int mapnum)
 {
-	// range check the lump number
-	if(lumpnum < 0 || lumpnum > numlumps)
-		return NULL;
+	unsigned int	hash;
 
-	Doom_ReadLump(lumpnum);
-	
-	return lumpdata[lumpnum];
+	hash			= Doom_HashKey(wad->lumpdir[wad->maplumps[mapnum]].name) & (wad->nummapchains - 1);
+	wad->mapnext[mapnum]	= wad->maphash[hash];
+	wad->maphash[hash]	= mapnum;
 }
 
-int Doom_LumpNumFromName(const char *lumpname)
+static int Wad_AddMap(wad_t *wad, int lumpnum)
 {
-	lumpinfo_t	*l;
+	int	mapnum;
 
-	for(l = lumpdir; l < lumpdir + numlumps; l++)
+	// grow the map index, rehashing all the maps
+	if (wad->nummaps == wad->maxmaps)
 	{
-		if(!strncmp(lumpname, l->name, 8))
-			return (int)(l - lumpdir);
+		wad->maxmaps		= wad->maxmaps ? wad->maxmaps * 2 : 64;
+		wad->maplumps		= (int*)Doom_Realloc(wad->maplumps, wad->maxmaps * sizeof(int));
+		wad->mapnext		= (int*)Doom_Realloc(wad->mapnext, wad->maxmaps * sizeof(int));
+		wad->maphash		= (int*)Doom_Realloc(wad->maphash, wad->maxmaps * sizeof(int));
+		wad->nummapchains	= wad->maxmaps;
+
+		memset(wad->maphash, -1, wad->nummapchains * sizeof(int));
+		for (int i = 0; i < wad->nummaps; i++)
+			Wad_HashMap(wad, i);
 	}
 
-	return -1;
+	mapnum = wad->nummaps;
+	wad->nummaps++;
+
+	wad->maplumps[mapnum] = lumpnum;
+	Wad_HashMap(wad, mapnum);
+
+	return mapnum;
 }
 
-void *Doom_LumpFromName(const char *lumpname)
+// add the maps from the lumps in the range to the map index
+static void Wad_IndexMaps(wad_t *wad, int firstlump, int lastlump)
 {
-	return Doom_LumpFromNum(Doom_LumpNumFromName(lumpname));
+	for (int i = firstlump; i < lastlump; i++)
+	{
+		int	mapnum;
+
+		if (!Wad_IsMapMarker(wad, i))
+			continue;
+
+		// a map with the same name replaces the earlier one in place
+		mapnum = Wad_FindMap(wad, wad->lumpdir[i].name);
+
+		if (mapnum < 0)
+			Wad_AddMap(wad, i);
+		else
+			wad->maplumps[mapnum] = i;
+	}
 }
 
-void Doom_ReadWadFile(const char *filename)
+// ______________________________________________
+// file access
+
+// map the whole file into memory, returns false if the file can't be mapped
+static bool Doom_MapFile(wadfile_t *file)
 {
-	FILE *fp;
+#ifdef DOOM_USE_MMAP
+	struct stat	st;
+	void		*base;
 
-	fp = fopen(filename, "rb");
+	if (fstat(fileno(file->fp), &st) < 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+		return false;
 
-	if(!fp)
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file->fp), 0);
+	if (base == MAP_FAILED)
+		return false;
+
+	file->mapbase	= (unsigned char*)base;
+	file->mapsize	= st.st_size;
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+static void Doom_UnmapFile(wadfile_t *file)
+{
+#ifdef DOOM_USE_MMAP
+	if (file->mapbase)
+		munmap(file->mapbase, file->mapsize);
+#endif
+	file->mapbase	= NULL;
+	file->mapsize	= 0;
+}
+
+// read bytes from the file, either by copying out of the mapping or through stdio
+static bool Doom_ReadBytes(wadfile_t *file, void *dest, long filepos, long numbytes)
+{
+	if (filepos < 0 || numbytes < 0)
+		return false;
+
+	if (file->mapbase)
 	{
-		printf("Failed to open wad file\n");
-		exit(-1);
+		if (filepos + numbytes > file->mapsize)
+			return false;
+
+		memcpy(dest, file->mapbase + filepos, numbytes);
+		return true;
 	}
 
-	files[numfiles] = fp;
-	numfiles++;
+	fseek(file->fp, filepos, SEEK_SET);
+	return fread(dest, 1, numbytes, file->fp) == (size_t)numbytes;
+}
+
+// release the pages of a mapped byte range back to the os, they're faulted
+// back in from the file if they're touched again
+static void Doom_ReleaseMappedBytes(wadfile_t *file, long filepos, long numbytes)
+{
+#ifdef DOOM_USE_MMAP
+	long		pagesize = sysconf(_SC_PAGESIZE);
+	unsigned long	start, end;
 
-	// read the header
-	dwadheader_t header;
-	fread(&header, sizeof(dwadheader_t), 1, fp);
+	// only whole pages inside the range can be released without touching neighbouring lumps
+	start	= ((unsigned long)(file->mapbase + filepos) + pagesize - 1) & ~(pagesize - 1);
+	end	= ((unsigned long)(file->mapbase + filepos + numbytes)) & ~(pagesize - 1);
 
-	// read the lump info table
-	fseek(fp, header.infotableofs, SEEK_SET);
+	if (end > start)
+		madvise((void*)start, end - start, MADV_DONTNEED);
+#endif
+}
 
-	// iterate through the lumps and add the directory
-	for(int i = 0; i < header.numlumps; i++)
-	{
-		dfilelump_t	filelump;
-		lumpinfo_t	*lumpinfo; 
+// ______________________________________________
+// lump cache
+
+static void Wad_UnlinkLRU(wad_t *wad, int lumpnum)
+{
+	lumpinfo_t	*l = wad->lumpdir + lumpnum;
 
-		// read the lump info
-		fread(&filelump, sizeof(dfilelump_t), 1, fp);
+	if (l->lruprev >= 0)
+		wad->lumpdir[l->lruprev].lrunext = l->lrunext;
+	else
+		wad->lruhead = l->lrunext;
 
-		// allocate an entry from the lump directory
-		lumpinfo = lumpdir + numlumps;
-		numlumps++;
+	if (l->lrunext >= 0)
+		wad->lumpdir[l->lrunext].lruprev = l->lruprev;
+	else
+		wad->lrutail = l->lruprev;
+
+	l->lruprev = -1;
+	l->lrunext = -1;
+}
+
+static void Wad_LinkLRU(wad_t *wad, int lumpnum)
+{
+	lumpinfo_t	*l = wad->lumpdir + lumpnum;
+
+	l->lruprev = -1;
+	l->lrunext = wad->lruhead;
+
+	if (wad->lruhead >= 0)
+		wad->lumpdir[wad->lruhead].lruprev = lumpnum;
+	else
+		wad->lrutail = lumpnum;
+
+	wad->lruhead = lumpnum;
+}
 
-		lumpinfo->fp        = fp;
-		lumpinfo->filepos	= filelump.filepos;
-		lumpinfo->size		= filelump.size;
-		strncpy(lumpinfo->name, filelump.name, 8);
+static void Wad_EvictLump(wad_t *wad, int lumpnum)
+{
+	lumpinfo_t	*l = wad->lumpdir + lumpnum;
+
+	if (!l->cached)
+		return;
+
+	if (wad->lumpdata[lumpnum])
+	{
+		free(wad->lumpdata[lumpnum]);
+		wad->lumpdata[lumpnum] = NULL;
 	}
+	else if (l->file->mapbase)
+	{
+		Doom_ReleaseMappedBytes(l->file, l->filepos, l->size);
+	}
+
+	Wad_UnlinkLRU(wad, lumpnum);
+	wad->cachesize	-= l->size;
+	l->cached	= false;
+}
+
+// evict the least recently used unlocked lumps until the cache fits the budget
+static void Wad_TrimCache(wad_t *wad, int keeplump)
+{
+	int	lumpnum, prev;
+
+	if (!wad->cachebudget)
+		return;
 
-	// re-read all the lumps
-	for(int i = 0; i < numlumps; i++)
+	for (lumpnum = wad->lrutail; lumpnum >= 0 && wad->cachesize > wad->cachebudget; lumpnum = prev)
 	{
-		if(lumpdata[i])
+		prev = wad->lumpdir[lumpnum].lruprev;
+
+		if (lumpnum == keeplump || wad->lumpdir[lumpnum].pins)
 			continue;
 
-		Doom_ReadLump(i);
+		Wad_EvictLump(wad, lumpnum);
 	}
 }
 
-void Doom_CloseAll()
+// load the lump if it isn't resident and make it the most recently used
+static void *Wad_CacheLump(wad_t *wad, int lumpnum)
+{
+	lumpinfo_t	*l = wad->lumpdir + lumpnum;
+	void		*data;
+
+	if (!l->size)
+		return NULL;
+
+	// mapped files hand out a pointer straight into the mapping
+	if (l->file->mapbase)
+	{
+		if ((long)l->filepos + l->size > l->file->mapsize)
+			return NULL;
+
+		data = l->file->mapbase + l->filepos;
+	}
+	else
+	{
+		if (!wad->lumpdata[lumpnum])
+		{
+			wad->lumpdata[lumpnum] = Doom_Malloc(l->size);
+
+			if (!Doom_ReadBytes(l->file, wad->lumpdata[lumpnum], l->filepos, l->size))
+			{
+				free(wad->lumpdata[lumpnum]);
+				wad->lumpdata[lumpnum] = NULL;
+				return NULL;
+			}
+		}
+
+		data = wad->lumpdata[lumpnum];
+	}
+
+	if (l->cached)
+	{
+		Wad_UnlinkLRU(wad, lumpnum);
+	}
+	else
+	{
+		l->cached = true;
+		wad->cachesize += l->size;
+	}
+
+	Wad_LinkLRU(wad, lumpnum);
+	Wad_TrimCache(wad, lumpnum);
+
+	return data;
+}
+
+// ______________________________________________
+// wad interface
+
+wad_t *Wad_Alloc()
+{
+	wad_t *wad;
+
+	wad = (wad_t*)Doom_Malloc(sizeof(wad_t));
+	memset(wad, 0, sizeof(wad_t));
+
+	wad->lruhead = -1;
+	wad->lrutail = -1;
+
+	return wad;
+}
+
+void Wad_Free(wad_t *wad)
 {
 	int	i;
 
-	for(i = 0; i < numfiles; i++)
+	if (!wad)
+		return;
+
+	for(i = 0; i < wad->numfiles; i++)
+		Wad_CloseFile(wad, i);
+
+	for(i = 0; i < wad->numlumps; i++)
+		free(wad->lumpdata[i]);
+
+	free(wad->files);
+	free(wad->lumpdir);
+	free(wad->lumpdata);
+	free(wad->lumphash);
+	free(wad->maplumps);
+	free(wad->mapnext);
+	free(wad->maphash);
+	free(wad);
+}
+
+int Wad_AddFile(wad_t *wad, const char *filename)
+{
+	FILE		*fp;
+	wadfile_t	*file;
+	dwadheader_t	header;
+	dfilelump_t	*filelumps;
+	int		firstlump;
+
+	fp = fopen(filename, "rb");
+
+	if(!fp)
+		return -1;
+
+	file = (wadfile_t*)Doom_Malloc(sizeof(wadfile_t));
+	file->fp	= fp;
+	file->mapbase	= NULL;
+	file->mapsize	= 0;
+
+	// try to map the file, falling back to reading the lumps with stdio
+	Doom_MapFile(file);
+
+	// read the header and the lump info table in one go
+	filelumps = NULL;
+
+	if (!Doom_ReadBytes(file, &header, 0, sizeof(dwadheader_t)) || header.numlumps < 0)
+		goto failed;
+
+	filelumps = (dfilelump_t*)Doom_Malloc(header.numlumps * sizeof(dfilelump_t) + 1);
+
+	if (!Doom_ReadBytes(file, filelumps, header.infotableofs, header.numlumps * sizeof(dfilelump_t)))
+		goto failed;
+
+	// add the file
+	if (wad->numfiles == wad->maxfiles)
+	{
+		wad->maxfiles	= wad->maxfiles ? wad->maxfiles * 2 : 8;
+		wad->files	= (wadfile_t**)Doom_Realloc(wad->files, wad->maxfiles * sizeof(wadfile_t*));
+	}
+
+	wad->files[wad->numfiles] = file;
+	wad->numfiles++;
+
+	// add the lumps to the directory, the lump data is read when it's first used
+	firstlump = wad->numlumps;
+	for(int i = 0; i < header.numlumps; i++)
 	{
-		fclose(files[i]);
+		Wad_AddLump(wad, filelumps[i].name, file, filelumps[i].filepos, filelumps[i].size);
 	}
 
-	for(i = 0; i < numlumps; i++)
+	free(filelumps);
+
+	Wad_IndexMaps(wad, firstlump, wad->numlumps);
+
+	return wad->numfiles - 1;
+
+failed:
+	free(filelumps);
+	Doom_UnmapFile(file);
+	fclose(fp);
+	free(file);
+
+	return -1;
+}
+
+void Wad_CloseFile(wad_t *wad, int filenum)
+{
+	wadfile_t	*file;
+	int		numlumps;
+	int		*remap;
+	int		*lruorder;
+	int		numlru;
+
+	if (filenum < 0 || filenum >= wad->numfiles || !wad->files[filenum])
+		return;
+
+	file = wad->files[filenum];
+
+	// remember the cache order before the lump numbers move
+	lruorder = (int*)Doom_Malloc(wad->numlumps * sizeof(int) + 1);
+	remap = (int*)Doom_Malloc(wad->numlumps * sizeof(int) + 1);
+
+	numlru = 0;
+	for (int i = wad->lruhead; i >= 0; i = wad->lumpdir[i].lrunext)
+		lruorder[numlru++] = i;
+
+	// remove the file's lumps from the directory
+	numlumps = 0;
+	for (int i = 0; i < wad->numlumps; i++)
 	{
-		if(!lumpdata[i])
+		if (wad->lumpdir[i].file == file)
+		{
+			if (wad->lumpdir[i].cached)
+				wad->cachesize -= wad->lumpdir[i].size;
+			free(wad->lumpdata[i]);
+			remap[i] = -1;
 			continue;
+		}
+
+		wad->lumpdir[numlumps]	= wad->lumpdir[i];
+		wad->lumpdata[numlumps]	= wad->lumpdata[i];
+		remap[i]		= numlumps;
+		numlumps++;
+	}
+
+	for (int i = numlumps; i < wad->numlumps; i++)
+		wad->lumpdata[i] = NULL;
+
+	wad->numlumps = numlumps;
+
+	// relink the cache in the same order with the new lump numbers
+	wad->lruhead = -1;
+	wad->lrutail = -1;
+
+	for (int i = numlru - 1; i >= 0; i--)
+	{
+		if (remap[lruorder[i]] >= 0)
+			Wad_LinkLRU(wad, remap[lruorder[i]]);
+	}
+
+	free(lruorder);
+	free(remap);
+
+	// the lump numbers have moved so rebuild the hash and map index
+	Wad_RehashLumps(wad);
+
+	wad->nummaps = 0;
+	if (wad->maphash)
+		memset(wad->maphash, -1, wad->nummapchains * sizeof(int));
+	Wad_IndexMaps(wad, 0, wad->numlumps);
+
+	Doom_UnmapFile(file);
+	fclose(file->fp);
+	free(file);
+
+	wad->files[filenum] = NULL;
+}
+
+int Wad_NumLumps(wad_t *wad)
+{
+	return wad->numlumps;
+}
+
+int Wad_LumpLength(wad_t *wad, int lumpnum)
+{
+	if(lumpnum < 0 || lumpnum >= wad->numlumps)
+		return 0;
+
+	return wad->lumpdir[lumpnum].size;
+}
+
+void *Wad_LumpFromNum(wad_t *wad, int lumpnum)
+{
+	// range check the lump number
+	if(lumpnum < 0 || lumpnum >= wad->numlumps)
+		return NULL;
+
+	return Wad_CacheLump(wad, lumpnum);
+}
+
+void *Wad_LockLump(wad_t *wad, int lumpnum)
+{
+	void	*data;
+
+	data = Wad_LumpFromNum(wad, lumpnum);
+
+	if (data)
+		wad->lumpdir[lumpnum].pins++;
+
+	return data;
+}
+
+void Wad_UnlockLump(wad_t *wad, int lumpnum)
+{
+	if(lumpnum < 0 || lumpnum >= wad->numlumps || !wad->lumpdir[lumpnum].pins)
+		return;
+
+	wad->lumpdir[lumpnum].pins--;
+
+	Wad_TrimCache(wad, -1);
+}
+
+void Wad_SetCacheBudget(wad_t *wad, long numbytes)
+{
+	wad->cachebudget = numbytes;
+
+	Wad_TrimCache(wad, -1);
+}
+
+long Wad_CacheSize(wad_t *wad)
+{
+	return wad->cachesize;
+}
+
+int Wad_LumpNumFromName(wad_t *wad, const char *lumpname)
+{
+	char	key[8];
+
+	if (!wad->numlumps)
+		return -1;
+
+	Doom_NameKey(key, lumpname);
+
+	return Wad_FindLump(wad, key);
+}
+
+void *Wad_LumpFromName(wad_t *wad, const char *lumpname)
+{
+	return Wad_LumpFromNum(wad, Wad_LumpNumFromName(wad, lumpname));
+}
+
+void Wad_LumpName(wad_t *wad, int lumpnum, char name[9])
+{
+	name[0] = 0;
+
+	if(lumpnum < 0 || lumpnum >= wad->numlumps)
+		return;
+
+	memcpy(name, wad->lumpdir[lumpnum].name, 8);
+	name[8] = 0;
+}
+
+int Wad_NumMaps(wad_t *wad)
+{
+	return wad->nummaps;
+}
+
+int Wad_MapLumpNum(wad_t *wad, int mapnum)
+{
+	if (mapnum < 0 || mapnum >= wad->nummaps)
+		return -1;
+
+	return wad->maplumps[mapnum];
+}
+
+int Wad_MapLumpNumFromName(wad_t *wad, const char *mapname)
+{
+	char	key[8];
+	int	mapnum;
+
+	Doom_NameKey(key, mapname);
+
+	mapnum = Wad_FindMap(wad, key);
+	if (mapnum < 0)
+		return -1;
+
+	return wad->maplumps[mapnum];
+}
+
+// ______________________________________________
+// default wad interface
 
-		free(lumpdata[i]);
+static wad_t *Doom_DefaultWad()
+{
+	if (!defaultwad)
+		defaultwad = Wad_Alloc();
+
+	return defaultwad;
+}
+
+int Doom_LumpLength(int lumpnum)
+{
+	return Wad_LumpLength(Doom_DefaultWad(), lumpnum);
+}
+
+void *Doom_LumpFromNum(int lumpnum)
+{
+	return Wad_LumpFromNum(Doom_DefaultWad(), lumpnum);
+}
+
+int Doom_LumpNumFromName(const char *lumpname)
+{
+	return Wad_LumpNumFromName(Doom_DefaultWad(), lumpname);
+}
+
+void *Doom_LumpFromName(const char *lumpname)
+{
+	return Doom_LumpFromNum(Doom_LumpNumFromName(lumpname));
+}
+
+void Doom_LumpName(int lumpnum, char name[9])
+{
+	Wad_LumpName(Doom_DefaultWad(), lumpnum, name);
+}
+
+void *Doom_LockLump(int lumpnum)
+{
+	return Wad_LockLump(Doom_DefaultWad(), lumpnum);
+}
+
+void Doom_UnlockLump(int lumpnum)
+{
+	Wad_UnlockLump(Doom_DefaultWad(), lumpnum);
+}
+
+void Doom_SetCacheBudget(long numbytes)
+{
+	Wad_SetCacheBudget(Doom_DefaultWad(), numbytes);
+}
+
+void Doom_ReadWadFile(const char *filename)
+{
+	if (Wad_AddFile(Doom_DefaultWad(), filename) < 0)
+	{
+		printf("Failed to read wad file\n");
+		exit(-1);
 	}
 }
 
+void Doom_CloseAll()
+{
+	Wad_Free(defaultwad);
+	defaultwad = NULL;
+}
+
+int Doom_NumMaps()
+{
+	return Wad_NumMaps(Doom_DefaultWad());
+}
+
+int Doom_MapLumpNum(int mapnum)
+{
+	return Wad_MapLumpNum(Doom_DefaultWad(), mapnum);
+}
+
+int Doom_MapLumpNumFromName(const char *mapname)
+{
+	return Wad_MapLumpNumFromName(Doom_DefaultWad(), mapname);
+}
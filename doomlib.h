@@ -3,13 +3,53 @@
 
 
 // wad / lump interface
+// lumps are loaded on first use, or point straight into the mapped wad file
+// when the platform supports it. with a cache budget set the least recently
+// used lumps are evicted once the budget is exceeded, so a lump pointer is only
+// valid until the next lump is loaded unless the lump is locked
 int Doom_LumpLength(int lumpnum);
 void *Doom_LumpFromNum(int lumpnum);
 int Doom_LumpNumFromName(const char *lumpname);
 void *Doom_LumpFromName(const char *lumpname);
+void Doom_LumpName(int lumpnum, char name[9]);
+void *Doom_LockLump(int lumpnum);
+void Doom_UnlockLump(int lumpnum);
+void Doom_SetCacheBudget(long numbytes);
 void Doom_ReadWadFile(const char *filename);
 void Doom_CloseAll();
 
+// map interface
+// maps are indexed when the wad is read, a map in a later file replaces the
+// earlier map with the same name
+int Doom_NumMaps();
+int Doom_MapLumpNum(int mapnum);
+int Doom_MapLumpNumFromName(const char *mapname);
+
+// wad sets
+// a wad set is an iwad plus any number of pwads stacked on top of it, lumps in
+// later files override lumps with the same name in earlier ones. closing a file
+// removes its lumps so lump numbers may change, file numbers stay valid. the
+// Doom_ interface above works on a single default wad set
+typedef struct wad_s wad_t;
+
+wad_t *Wad_Alloc();
+void Wad_Free(wad_t *wad);
+int Wad_AddFile(wad_t *wad, const char *filename);
+void Wad_CloseFile(wad_t *wad, int filenum);
+int Wad_NumLumps(wad_t *wad);
+int Wad_LumpLength(wad_t *wad, int lumpnum);
+void *Wad_LumpFromNum(wad_t *wad, int lumpnum);
+int Wad_LumpNumFromName(wad_t *wad, const char *lumpname);
+void *Wad_LumpFromName(wad_t *wad, const char *lumpname);
+void Wad_LumpName(wad_t *wad, int lumpnum, char name[9]);
+void *Wad_LockLump(wad_t *wad, int lumpnum);
+void Wad_UnlockLump(wad_t *wad, int lumpnum);
+void Wad_SetCacheBudget(wad_t *wad, long numbytes);
+long Wad_CacheSize(wad_t *wad);
+int Wad_NumMaps(wad_t *wad);
+int Wad_MapLumpNum(wad_t *wad, int mapnum);
+int Wad_MapLumpNumFromName(wad_t *wad, const char *mapname);
+
 #define THINGS_OFFSET		1
 #define LINEDEFS_OFFSET		2
 #define	SIDEDEFS_OFFSET		3
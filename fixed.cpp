@@ -0,0 +1,141 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include "plane2.h"
+#include "fixed.h"
+
+// ______________________________________________
+// exact planes
+
+exactplane_t ExactPlane_Make(int64_t a, int64_t b, int64_t c)
+{
+	exactplane_t	plane;
+
+	plane.a = a;
+	plane.b = b;
+	plane.c = c * FRACUNIT;
+
+	// rounding a split point moves each coordinate by at most half a unit
+	plane.epsilon = (llabs(a) + llabs(b) + 1) / 2;
+
+	return plane;
+}
+
+exactplane_t ExactPlane_Reverse(exactplane_t plane)
+{
+	plane.a = -plane.a;
+	plane.b = -plane.b;
+	plane.c = -plane.c;
+
+	return plane;
+}
+
+int64_t ExactPlane_Distance(const exactplane_t *plane, fixed_t x, fixed_t y)
+{
+	return plane->a * x + plane->b * y + plane->c;
+}
+
+int ExactPlane_PointOnPlaneSide(const exactplane_t *plane, fixed_t x, fixed_t y)
+{
+	int64_t d = ExactPlane_Distance(plane, x, y);
+
+	if (d > plane->epsilon)
+		return PLANE_SIDE_FRONT;
+	if (d < -plane->epsilon)
+		return PLANE_SIDE_BACK;
+
+	return PLANE_SIDE_ON;
+}
+
+int FixedLine_OnPlaneSide(const fixedline_t *l, const exactplane_t *plane)
+{
+	int sides[2];
+
+	sides[0] = ExactPlane_PointOnPlaneSide(plane, l->v[0][0], l->v[0][1]);
+	sides[1] = ExactPlane_PointOnPlaneSide(plane, l->v[1][0], l->v[1][1]);
+
+	if (sides[0] == PLANE_SIDE_ON && sides[1] == PLANE_SIDE_ON)
+		return PLANE_SIDE_ON;
+	if (sides[0] != PLANE_SIDE_BACK && sides[1] != PLANE_SIDE_BACK)
+		return PLANE_SIDE_FRONT;
+	if (sides[0] != PLANE_SIDE_FRONT && sides[1] != PLANE_SIDE_FRONT)
+		return PLANE_SIDE_BACK;
+
+	return PLANE_SIDE_CROSS;
+}
+
+#ifdef __SIZEOF_INT128__
+
+// num / den rounded to the nearest integer, den must be positive
+static int64_t DivRound(__int128 num, __int128 den)
+{
+	__int128 n = 2 * num + den;
+	__int128 d = 2 * den;
+	__int128 q = n / d;
+
+	// round towards minus infinity rather than zero
+	if (n % d < 0)
+		q--;
+
+	return (int64_t)q;
+}
+
+#endif
+
+void FixedLine_SplitPoint(const fixedline_t *l, const exactplane_t *plane, fixed_t mid[2])
+{
+	int64_t d0 = ExactPlane_Distance(plane, l->v[0][0], l->v[0][1]);
+	int64_t d1 = ExactPlane_Distance(plane, l->v[1][0], l->v[1][1]);
+	int64_t den = d0 - d1;
+
+	if (den < 0)
+	{
+		d0 = -d0;
+		den = -den;
+	}
+
+	for (int i = 0; i < 2; i++)
+	{
+		int64_t delta = (int64_t)l->v[1][i] - l->v[0][i];
+
+#ifdef __SIZEOF_INT128__
+		mid[i] = (fixed_t)(l->v[0][i] + DivRound((__int128)delta * d0, den));
+#else
+		mid[i] = (fixed_t)(l->v[0][i] + llround((double)delta * ((double)d0 / (double)den)));
+#endif
+	}
+}
+
+bool ExactPlane_Intersect(const exactplane_t *p1, const exactplane_t *p2, fixed_t point[2])
+{
+#ifdef __SIZEOF_INT128__
+	// the products of a coefficient and a scaled c can overflow 64 bits
+	__int128 det = (__int128)p1->a * p2->b - (__int128)p2->a * p1->b;
+
+	if (det == 0)
+		return false;
+
+	__int128 x = (__int128)p1->b * p2->c - (__int128)p2->b * p1->c;
+	__int128 y = (__int128)p2->a * p1->c - (__int128)p1->a * p2->c;
+
+	if (det < 0)
+	{
+		det = -det;
+		x = -x;
+		y = -y;
+	}
+
+	point[0] = (fixed_t)DivRound(x, det);
+	point[1] = (fixed_t)DivRound(y, det);
+#else
+	double det = (double)p1->a * p2->b - (double)p2->a * p1->b;
+
+	if (det == 0.0)
+		return false;
+
+	point[0] = (fixed_t)llround(((double)p1->b * p2->c - (double)p2->b * p1->c) / det);
+	point[1] = (fixed_t)llround(((double)p2->a * p1->c - (double)p1->a * p2->c) / det);
+#endif
+
+	return true;
+}
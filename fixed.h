@@ -0,0 +1,58 @@
+#ifndef __FIXED_H__
+#define __FIXED_H__
+
+#include <stdint.h>
+
+// ______________________________________________
+// fixed point
+
+// 16.16 fixed point, every map coordinate fits
+typedef int fixed_t;
+
+#define	FRACBITS		16
+#define	FRACUNIT		(1 << FRACBITS)
+
+typedef struct fixedline_s
+{
+	fixed_t	v[2][2];
+
+} fixedline_t;
+
+// ______________________________________________
+// exact planes
+
+// a plane with integer coefficients through two integer points. distances
+// are exact for fixed point points, a point is on the plane if it's within
+// the error of rounding a split point to fixed point, which points with
+// integer coordinates never are unless they're exactly on the plane
+typedef struct exactplane_s
+{
+	int64_t	a;
+	int64_t	b;
+
+	// already scaled by FRACUNIT
+	int64_t	c;
+
+	int64_t	epsilon;
+
+} exactplane_t;
+
+exactplane_t ExactPlane_Make(int64_t a, int64_t b, int64_t c);
+exactplane_t ExactPlane_Reverse(exactplane_t plane);
+
+// returns the distance scaled by the length of the plane normal and FRACUNIT
+int64_t ExactPlane_Distance(const exactplane_t *plane, fixed_t x, fixed_t y);
+int ExactPlane_PointOnPlaneSide(const exactplane_t *plane, fixed_t x, fixed_t y);
+
+int FixedLine_OnPlaneSide(const fixedline_t *l, const exactplane_t *plane);
+
+// returns the point where the line crosses the plane rounded to the nearest fixed point
+void FixedLine_SplitPoint(const fixedline_t *l, const exactplane_t *plane, fixed_t mid[2]);
+
+// the point where two planes cross rounded to the nearest fixed point, false if
+// they're parallel. split points worked out from the planes of the original
+// lines are only ever rounded once, where splitting a line that was already
+// split would add to the error of its rounded ends
+bool ExactPlane_Intersect(const exactplane_t *p1, const exactplane_t *p2, fixed_t point[2]);
+
+#endif
@@ -1,261 +1,78 @@
-#include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <memory.h>
 #include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "common.h"
 #include "doomlib.h"
 #include "vec2.h"
 #include "box2.h"
 #include "plane2.h"
 #include "polygon.h"
-
-float globalepsilon = 0.2f;
-
-// ______________________________________________
-// errors and warnings
-
-void Error(const char *error, ...)
-{
-	va_list valist;
-	char buffer[2048];
-	
-	va_start(valist, error);
-	vsprintf(buffer, error, valist);
-	va_end(valist);
-	
-	fprintf(stderr, "\x1b[31m");
-	fprintf(stderr, "Error: %s", buffer);
-	fprintf(stderr, "\x1b[0m");
-	exit(1);
-}
-
-void Warning(const char *warning, ...)
-{
-	va_list valist;
-	char buffer[2048];
-	
-	va_start(valist, warning);
-	vsprintf(buffer, warning, valist);
-	va_end(valist);
-	
-	fprintf(stderr, "\x1b[33m");
-	fprintf(stderr, "Warning: %s", buffer);
-	fprintf(stderr, "\x1b[0m");
-}
+#include "polypool.h"
+#include "bsp.h"
 
 // ______________________________________________
-// Memory allocation
-
-void *Malloc(int numbytes)
-{
-	void *mem;
-	
-	mem = malloc(numbytes);
-
-	if (!mem)
-	{
-		Error("Malloc: Failed to allocated memory");
-	}
-
-	return mem;
-}
-
-void *MallocZeroed(int numbytes)
-{
-	void *mem;
-	
-	mem = Malloc(numbytes);
-
-	memset(mem, 0, numbytes);
-
-	return mem;
-}
-
-vec2 Plane_GetNormal(plane_t plane)
-{
-	return plane.GetNormal();
-}
-
-float GetDistance(plane_t plane)
-{
-	return plane.GetDistance();
-}
-
-float Plane_PointDistance(plane_t plane, vec2 p)
-{
-	return plane.Distance(p);
-}
-
-int Plane_PointOnPlaneSide(plane_t plane, vec2 p, float epsilon)
-{
-	return plane.PointOnPlaneSide(p, epsilon);
-}
-
-typedef struct line_s
-{
-	vec2	v[2];
-
-} line_t;
-
-line_t * Line_Alloc()
-{
-	return (line_t*)malloc(sizeof(line_t));
-}
+// doomlib
 
-line_t *Line_Copy(line_t *s)
+// how to build each map
+typedef struct buildoptions_s
 {
-	line_t *d;
-
-	d = Line_Alloc();
-	d->v[0] = s->v[0];
-	d->v[1] = s->v[1];
-
-	return d;
-}
+	// number of split plane candidates scored per node, 0 scores them all
+	int		maxcandidates;
 
-int Line_OnPlaneSide(line_t *l, plane_t plane, float epsilon) 
-{
-	int sides[2];
+	// one of SPLIT_*
+	int		heuristic;
 
-	sides[0] = Plane_PointOnPlaneSide(plane, l->v[0], epsilon);
-	sides[1] = Plane_PointOnPlaneSide(plane, l->v[1], epsilon);
+	// threads used to build a map's tree
+	int		numthreads;
 
-	if (sides[0] == PLANE_SIDE_ON && sides[1] == PLANE_SIDE_ON)
-		return PLANE_SIDE_ON;
+	// split with exact integer plane tests
+	bool		exact;
 
-	// if nothing on the back side then line is in front
-	if (sides[0] != PLANE_SIDE_BACK && sides[1] != PLANE_SIDE_BACK)
-		return PLANE_SIDE_FRONT;
+	// also write the leaf polygons as text for the viewer
+	bool		leafgld;
 
-	// if nothing on front side then line is on back side
-	if (sides[0] != PLANE_SIDE_FRONT && sides[1] != PLANE_SIDE_FRONT)
-		return PLANE_SIDE_BACK;
+	// time the tree queries after building
+	bool		benchmark;
 
-	return PLANE_SIDE_CROSS;
-}
+} buildoptions_t;
 
-void Line_SplitWithPlane(line_t *l, plane_t plane, float epsilon, line_t **f, line_t **b)
+// a map read from the wad along with where its output goes
+typedef struct mapjob_s
 {
-	int sides[2];
+	char		mapname[9];
 
-	sides[0] = Plane_PointOnPlaneSide(plane, l->v[0], epsilon);
-	sides[1] = Plane_PointOnPlaneSide(plane, l->v[1], epsilon);
+	// output files are prefixed with the map name when building several maps
+	char		outprefix[16];
+	bool		verbose;
 
-	// both points are on the plane
-	if (sides[0] == PLANE_SIDE_ON && sides[1] == PLANE_SIDE_ON)
-	{
-		*f = NULL;
-		*b = NULL;
-		return;
-	}
+	buildoptions_t	options;
 
-	// if nothing on back side then line is in front
-	if (sides[0] != PLANE_SIDE_BACK && sides[1] != PLANE_SIDE_BACK)
-	{
-		*f = Line_Copy(l);
-		*b = NULL;
-		return;
-	}
+	int		numvertices;
+	vec2		*vertices;
+	int		numlinedefs;
+	linedef_t	*linedefs;
 
-	// if nothing on front side then line is on back side
-	if (sides[0] != PLANE_SIDE_FRONT && sides[1] != PLANE_SIDE_FRONT)
-	{
-		*f = NULL;
-		*b = Line_Copy(l);
-		return;
-	}
-
-	// the points cross the plane so generate a split point
-	{
-		vec2 mid;
-		int i;
-
-		// calculate split point
-		for (i = 0; i < 2; i++)
-		{
-			// avoid round off error when possible
-			if (plane[i] == 1)
-			{
-				mid[i] = -plane[2];
-			}
-			else if (plane[i] == -1)
-			{
-				mid[i] = plane[2];
-			}
-			else
-			{
-				float dist1, dist2, dot;
-				
-				dist1 = Distance(plane, l->v[0]);
-				dist2 = Distance(plane, l->v[1]);
-				dot = dist1 / (dist1 - dist2);
-				mid[i] = (l->v[0][i] * (1.0f - dot)) + (dot * l->v[1][i]);
-			}
-		}
-
-		// create the new front and back lines
-		if (sides[0] == PLANE_SIDE_FRONT)
-		{
-			*f = Line_Alloc();
-			*b = Line_Alloc();
-			(*f)->v[0] = l->v[0];
-			(*f)->v[1] = mid;
-			(*b)->v[0] = mid;
-			(*b)->v[1] = l->v[1];
-		}
-		else
-		{
-			*f = Line_Alloc();
-			*b = Line_Alloc();
-			(*b)->v[0] = l->v[0];
-			(*b)->v[1] = mid;
-			(*f)->v[0] = mid;
-			(*f)->v[1] = l->v[1];
-		}
-	}
-}
-
-vec2 Line_GetNormal(line_t *l)
-{
-	vec2 n;
-
-	n = l->v[1] - l->v[0];
-	n = Skew(n);
-	n = Normalize(n);
+	// build stats
+	int		numnodes;
+	int		numleafs;
 
-	return n;
-}
+} mapjob_t;
 
-plane_t Line_Plane(line_t *l)
+static FILE *OpenOutputFile(mapjob_t *job, const char *filename, const char *mode)
 {
-	vec2		n;
-	plane_t		plane;
-
-	n = Line_GetNormal(l);
+	char	path[1024];
 
-	plane[0] = n[0];
-	plane[1] = n[1];
-	plane[2] = -Dot(n, l->v[0]);
+	snprintf(path, sizeof(path), "%s%s", job->outprefix, filename);
 
-	return plane;
+	return fopen(path, mode);
 }
-	
-// ______________________________________________
-// doomlib
 
-typedef struct linedef_s
-{
-	int	vertices[2];
-	int	sidedefs[2];
-
-} linedef_t;
-
-int numvertices;
-vec2 *vertices;
-int numlinedefs;
-linedef_t *linedefs;
-
-static void DumpVertices(int lumpnum)
+static void DumpVertices(mapjob_t *job, int lumpnum)
 {
 	void	*data;
 	int 	lumpsize;
@@ -263,8 +80,8 @@ static void DumpVertices(int lumpnum)
 	data			= Doom_LumpFromNum(lumpnum);
 	lumpsize		= Doom_LumpLength(lumpnum);
 
-	numvertices		= lumpsize / (2 * sizeof(short));
-	vertices		= (vec2*)MallocZeroed(numvertices * sizeof(vec2));
+	int numvertices		= lumpsize / (2 * sizeof(short));
+	vec2 *vertices		= (vec2*)MallocZeroed(numvertices * sizeof(vec2));
 
 	short *fixedptr		= (short*)data;
 
@@ -281,9 +98,12 @@ static void DumpVertices(int lumpnum)
 
 		//printf("vertex %4i: %12.4f, %12.4f\n", i, xy[0], xy[1]);
 	}
+
+	job->numvertices	= numvertices;
+	job->vertices		= vertices;
 }
 
-static void DumpLinedefs(int lumpnum)
+static void DumpLinedefs(mapjob_t *job, int lumpnum)
 {
 	void	*data;
 	int 	lumpsize;
@@ -291,8 +111,8 @@ static void DumpLinedefs(int lumpnum)
 	data			= Doom_LumpFromNum(lumpnum);
 	lumpsize		= Doom_LumpLength(lumpnum);
 
-	numlinedefs		= lumpsize / sizeof(dlinedef_t);
-	linedefs		= (linedef_t*)MallocZeroed(numlinedefs * sizeof(linedef_t));
+	int numlinedefs		= lumpsize / sizeof(dlinedef_t);
+	linedef_t *linedefs	= (linedef_t*)MallocZeroed(numlinedefs * sizeof(linedef_t));
 
 	dlinedef_t *lptr	= (dlinedef_t*)data;
 
@@ -310,277 +130,32 @@ static void DumpLinedefs(int lumpnum)
 
 		lptr++;
 	}
+
+	job->numlinedefs	= numlinedefs;
+	job->linedefs		= linedefs;
 }
 
-static void DumpMapData(const char *mapname)
+static void DumpMapData(mapjob_t *job, const char *mapname)
 {
-	int baselump = Doom_LumpNumFromName(mapname);
+	int baselump = Doom_MapLumpNumFromName(mapname);
 
-	if (baselump < 0 || Doom_LumpLength(baselump) != 0)
+	if (baselump < 0)
 	{
 		Error("Map \"%s\" not found\n", mapname);
 		exit(-1);
 	}
 
-	DumpLinedefs(baselump + LINEDEFS_OFFSET);
-	DumpVertices(baselump + VERTICES_OFFSET);
-}
-
-// ______________________________________________
-// bsp tree
-
-// nodes
-typedef struct bspnode_s
-{
-	struct bspnode_s	*next;
-	struct bspnode_s	*treenext;
-	struct bspnode_s	*leafnext;
-	struct bspnode_s	*parent;
-	struct bspnode_s	*children[2];
-	struct bsptree_s	*tree;
-	
-	// the node split plane
-	plane_t			plane;
-	
-	bool			empty;
-
-} bspnode_t;
-
-// tree
-typedef struct bsptree_s
-{
-	bspnode_t	*nodes;
-	int		numnodes;
-	int		numleafs;
-	int		depth;
-	
-	bspnode_t	*root;
-	bspnode_t	*leafs;
-
-	plane_t		plane;
-	
-} bsptree_t;
-
-typedef struct bspline_s
-{
-	struct bspline_s	*next;
-	line_t			*line;
-
-} bspline_t;
-
-// global list of bsp nodes
-static bspnode_t	*bspnodes;
-
-static bspnode_t *AllocNode()
-{
-	bspnode_t *n;
-	
-	n = (bspnode_t*)MallocZeroed(sizeof(bspnode_t));
-	
-	// link the node into the global list
-	n->next = bspnodes;
-	bspnodes = n;
-	
-	return n;
-}
-
-static bsptree_t *MallocTree()
-{
-	return (bsptree_t*)MallocZeroed(sizeof(bsptree_t));
-}
-
-static bspline_t *MallocBSPLine(line_t *line)
-{
-	bspline_t	*p;
-	
-	p = (bspline_t*)MallocZeroed(sizeof(bspline_t));
-	p->line = line;
-	
-	return p;
-}
-
-static bspnode_t *MallocBSPNode(bsptree_t *tree, bspnode_t *parent)
-{
-	bspnode_t *n = AllocNode();
-	
-	n->parent = parent;
-	n->tree	= tree;
-	
-	// link the node into the tree list
-	n->treenext = tree->nodes;
-	tree->nodes = n;
-	tree->numnodes++;
-	
-	return n;
-}
-
-static void SplitLine(plane_t plane, bspline_t *l, float epsilon, bspline_t **f, bspline_t **b)
-{
-	line_t *ff, *bb;
-
-	*f = *b = NULL;
-	
-	// split the line
-	Line_SplitWithPlane(l->line, plane, epsilon, &ff, &bb);
-	
-	if (ff)
-		*f = MallocBSPLine(ff);
-	if (bb)
-		*b = MallocBSPLine(bb);
-	
-	// check that the split polygon sits in the original's plane
-	//if (*f && !CheckPolygonOnPlane(*f, PolygonPlane(p)))
-	//	Error("Front polygon doesn't sit on original plane after split\n");
-	//if (*b && !CheckPolygonOnPlane(*b, PolygonPlane(p)))
-	//	Error("Back polygon doesn't sit on original plane after split\n");
-}
-
-static int CalculateSplitPlaneScore(plane_t plane, bspline_t *list)
-{
-	int score = 0;
-	
-	for (; list; list = list->next)
-	{
-		// favour polygons that don't cause splits
-		int side = Line_OnPlaneSide(list->line, plane, globalepsilon);
-		if (side != PLANE_SIDE_CROSS)
-			score += 1;
-		
-		// favour planes which are axial
-		//if (plane.IsAxial())
-		//	score += 1;
-	}
-	
-	return score;
-}
-
-static plane_t SelectSplitPlane(bspline_t *list)
-{
-	int bestscore = 0;
-	plane_t bestplane;
-	bspline_t *l;
-	
-	for (l = list; l; l = l->next)
-	{
-		plane_t plane = Line_Plane(l->line);
-		int score = CalculateSplitPlaneScore(plane, list);
-	
-		if (!bestscore || score > bestscore)
-		{
-			bestscore	= score;
-			bestplane	= plane;
-		}
-			
-	}
-	
-	return bestplane;
-}
-
-static void PartitionLineList(plane_t plane, bspline_t *list, bspline_t **sides)
-{
-	sides[0] = NULL;
-	sides[1] = NULL;
-	
-	for (; list; list = list->next)
-	{
-		bspline_t *split[2];
-		int i;
-
-		SplitLine(plane, list, globalepsilon, &split[0], &split[1]);
-
-		// process the front (0) and back (1) splits
-		for (i = 0; i < 2; i++)
-		{
-			if (split[i])
-			{
-				split[i]->next = sides[i];
-				sides[i] = split[i];
-			}
-		}
-	}
-}
-
-void BuildTreeRecursive(bsptree_t *tree, bspnode_t *node, bspline_t *lines)
-{
-	plane_t		plane;
-	bspline_t	*sides[2];
-
-	if (!lines)
-	{
-		node->leafnext = tree->leafs;
-		tree->leafs = node;
-
-		tree->numleafs++;
-		return;
-	}
-
-	plane = SelectSplitPlane(lines);
-
-	PartitionLineList(plane, lines, sides);
-
-	node->plane = plane;
-	
-	// add two new nodes to the tree
-	node->children[0] = MallocBSPNode(tree, node);
-	node->children[1] = MallocBSPNode(tree, node);
-	
-	// recurse down the front and back sides
-	BuildTreeRecursive(tree, node->children[0], sides[0]);
-	BuildTreeRecursive(tree, node->children[1], sides[1]);
-}
-
-bspline_t *MakeLineList()
-{
-	bspline_t *list = NULL;
-
-	for (int i = 0; i < numlinedefs; i++)
-	{
-		line_t *line = Line_Alloc();
-
-		line->v[0][0] = vertices[linedefs[i].vertices[0]][0];
-		line->v[0][1] = vertices[linedefs[i].vertices[0]][1];
-		line->v[1][0] = vertices[linedefs[i].vertices[1]][0];
-		line->v[1][1] = vertices[linedefs[i].vertices[1]][1];
-
-		//printf("line %i, %f, %f, %f, %f\n",
-		//	i,
-		//	line->v[0][0],
-		//	line->v[0][1],
-		//	line->v[1][0],
-		//	line->v[1][1]);
-
-		bspline_t *bspline = MallocBSPLine(line);
-		bspline->next = list;
-		list = bspline;
-	}
-
-	return list;
-}
-
-bsptree_t *MakeEmptyTree()
-{
-	bsptree_t	*tree;
-	
-	tree = (bsptree_t*)MallocZeroed(sizeof(bsptree_t));
-	tree->root = MallocBSPNode(tree, NULL);
-
-	return tree;
-}
-
-bsptree_t *BuildTree()
-{
-	 bspline_t *lines = MakeLineList();
-
-	bsptree_t *tree = MakeEmptyTree();
-
-	BuildTreeRecursive(tree, tree->root, lines);
+	Doom_LumpName(baselump, job->mapname);
 
-	return tree;
+	DumpLinedefs(job, baselump + LINEDEFS_OFFSET);
+	DumpVertices(job, baselump + VERTICES_OFFSET);
 }
 
 // ______________________________________________
 // drawing
 
+#define	OUTPUT_BUFFER_SIZE	(1024 * 1024)
+
 static void HSVToRGB(float rgb[3], float h, float s, float v)
 {
 	float r, g, b;
@@ -606,76 +181,22 @@ static void HSVToRGB(float rgb[3], float h, float s, float v)
 	rgb[2] = b;
 }
 
-polygon_t *MakeFullPolygon()
-{
-	polygon_t *p = Polygon_Alloc(4);
-	float s = 16384.0f;
-
-	p->vertices[0][0]	=  -s;
-	p->vertices[0][1]	=  -s;
-	p->vertices[1][0]	=   s;
-	p->vertices[1][1]	=  -s;
-	p->vertices[2][0]	=   s;
-	p->vertices[2][1]	=   s;
-	p->vertices[3][0]	=  -s;
-	p->vertices[3][1]	=   s;
-	p->numvertices		= 4;
-
-	return p;
-}
-
-// wind up to the root then clip on unwind
-polygon_t *ClipPolygonIntoLeafRecursive(polygon_t *p, bspnode_t *node, bspnode_t *prev)
-{
-	if (!node)
-		return p;
-	
-	p = ClipPolygonIntoLeafRecursive(p, node->parent, node);
-	
-	// the result of the previous clip might have completely clipped the polygon
-	if (!p)
-		return NULL;
-	
-	// have to special case this as side on will clip the polygon
-	//if (Polygon_OnPlaneSide(p, node->plane, globalepsilon) == PLANE_SIDE_ON)
-	//	return p;
-	
-	// flip the plane if we followed the back link to get here
-	plane_t plane = node->plane;
-	if (node->children[1] == prev)
-		plane = -plane;
-	
-	// clip the polygon with the current leaf plane
-	return Polygon_ClipWithPlane(p, plane, globalepsilon);
-	
-	return p;
-}
-
-polygon_t *MakeLeafPolygon(bspnode_t *leaf)
-{
-	polygon_t *p = MakeFullPolygon();
-
-	p = ClipPolygonIntoLeafRecursive(p, leaf->parent, leaf);
-
-	return p;
-}
-
-void BuildLeafPolygons(bsptree_t *tree)
+// the text format is for looking at in the viewer, it takes far longer to
+// write than the binary file on big maps
+static void WriteLeafPolygonsText(mapjob_t *job, bsptree_t *tree, polygon_t **polygons)
 {
 	bspnode_t *leaf;
 
-	FILE *fp = fopen("leaf_polygons.gld", "w");
+	FILE *fp = OpenOutputFile(job, "leaf_polygons.gld", "w");
+	setvbuf(fp, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
 
 	int leafnum = 0;
 	for (leaf = tree->leafs; leaf; leaf = leaf->leafnext)
 	{
-		polygon_t *p = MakeLeafPolygon(leaf);
+		polygon_t *p = polygons[leaf->leafnum];
 
 		if (!p)
-		{
-			printf("leaf was clipped away!\n");
 			continue;
-		}
 
 		{
 			float f = (float)leafnum / tree->numleafs;
@@ -720,82 +241,120 @@ void BuildLeafPolygons(bsptree_t *tree)
 					v[1]);
 		}
 
-		fflush(fp);
-
 		leafnum++;
 	}
 
 	fclose(fp);
 }
 
-int Sign(float x)
+// leaf_polygons.bin is a header, a leafrecord_t for every leaf with a polygon
+// in leaf order, then all the vertices as float x y pairs
+#define	LEAF_FILE_ID		(('F' << 24) | ('A' << 16) | ('E' << 8) | 'L')
+#define	LEAF_FILE_VERSION	1
+
+#define	LEAF_EMPTY		1
+
+typedef struct leafheader_s
 {
-	return (0.0f < x) - (x < 0.0f);
-}
+	int	id;
+	int	version;
+	int	numrecords;
+	int	numvertices;
 
-// if the line sits on the plane then  send the plane down the front or back side depending on whether the line normal
-// faces the same direction as the plane
-void FilterLineIntoLeaf(bspnode_t *n, line_t *l)
+} leafheader_t;
+
+typedef struct leafrecord_s
+{
+	int	leafnum;
+	int	flags;		// LEAF_*
+	int	firstvertex;
+	int	numvertices;
+
+} leafrecord_t;
+
+static void WriteLeafPolygonsBinary(mapjob_t *job, bsptree_t *tree, polygon_t **polygons)
 {
-	if (!n->children[0] && !n->children[1])
+	leafheader_t	header;
+	leafrecord_t	*records;
+	float		*vertices;
+	char		*buffer;
+	int		numbytes;
+
+	header.id		= LEAF_FILE_ID;
+	header.version		= LEAF_FILE_VERSION;
+	header.numrecords	= 0;
+	header.numvertices	= 0;
+
+	for (int i = 0; i < tree->numleafs; i++)
 	{
-		// this is a leaf node
-		n->empty = true;
-		return;
+		if (!polygons[i])
+			continue;
+
+		header.numrecords++;
+		header.numvertices += polygons[i]->numvertices;
 	}
 
-	int side = Line_OnPlaneSide(l, n->plane, globalepsilon);
+	// the whole file is built in memory and written at once
+	numbytes = sizeof(leafheader_t) + header.numrecords * sizeof(leafrecord_t) + header.numvertices * 2 * sizeof(float);
+	buffer = (char*)Malloc(numbytes);
+
+	memcpy(buffer, &header, sizeof(leafheader_t));
+	records = (leafrecord_t*)(buffer + sizeof(leafheader_t));
+	vertices = (float*)(records + header.numrecords);
 
-	if (side == PLANE_SIDE_FRONT)
-		FilterLineIntoLeaf(n->children[0], l);
-	else if (side == PLANE_SIDE_BACK)
-		FilterLineIntoLeaf(n->children[1], l);
-	else if (side == PLANE_SIDE_ON)
+	int firstvertex = 0;
+	for (int i = 0; i < tree->numleafs; i++)
 	{
-		float dot = Dot(n->plane.GetNormal(), Line_GetNormal(l));
+		polygon_t *p = polygons[i];
 
-		// map 1 to the front child and -1 to the back child
-		int facing = (dot > 0.0f ? 0 : 1);
+		if (!p)
+			continue;
 
-		FilterLineIntoLeaf(n->children[facing], l);
-	}
-	else if (side == PLANE_SIDE_CROSS)
-	{
-		line_t *f, *b;
-		Line_SplitWithPlane(l, n->plane, globalepsilon, &f, &b);
+		records->leafnum	= i;
+		records->flags		= tree->cleafs[i].empty ? LEAF_EMPTY : 0;
+		records->firstvertex	= firstvertex;
+		records->numvertices	= p->numvertices;
+		records++;
+
+		for (int j = 0; j < p->numvertices; j++)
+		{
+			*vertices++ = p->vertices[j][0];
+			*vertices++ = p->vertices[j][1];
+		}
 
-		FilterLineIntoLeaf(n, f);
-		FilterLineIntoLeaf(n, b);
+		firstvertex += p->numvertices;
 	}
+
+	FILE *fp = OpenOutputFile(job, "leaf_polygons.bin", "wb");
+	fwrite(buffer, 1, numbytes, fp);
+	fclose(fp);
+
+	free(buffer);
 }
 
-void MarkEmptyLeafs(bsptree_t *tree)
+static void BuildLeafPolygons(mapjob_t *job, bsptree_t *tree)
 {
-	// filter all linedefs into the tree
-	for (int i = 0; i < numlinedefs; i++)
+	polygon_t **polygons = tree->leafpolygons;
+
+	for (int i = 0; i < tree->numleafs; i++)
 	{
-		for (int j = 0; j < 2; j++)
-		{
-			if (linedefs[i].sidedefs[j] == -1)
-				continue;
-
-			// create a line for this linedef side
-			line_t *line = Line_Alloc();
-			line->v[0][0] = vertices[linedefs[i].vertices[j ^ 0]][0];
-			line->v[0][1] = vertices[linedefs[i].vertices[j ^ 0]][1];
-			line->v[1][0] = vertices[linedefs[i].vertices[j ^ 1]][0];
-			line->v[1][1] = vertices[linedefs[i].vertices[j ^ 1]][1];
-
-			// filter the line into the tree
-			FilterLineIntoLeaf(tree->root, line);
-		}
+		if (!polygons[i])
+			printf("leaf was clipped away!\n");
 	}
-}
 
+	WriteLeafPolygonsBinary(job, tree, polygons);
+
+	if (job->options.leafgld)
+		WriteLeafPolygonsText(job, tree, polygons);
+}
 
-void WriteDebugMap()
+static void WriteDebugMap(mapjob_t *job)
 {
-	FILE *fp = fopen("debug_map.gld", "w");
+	int		numlinedefs = job->numlinedefs;
+	vec2		*vertices = job->vertices;
+	linedef_t	*linedefs = job->linedefs;
+
+	FILE *fp = OpenOutputFile(job, "debug_map.gld", "w");
 
 	fprintf(fp, "color 1 1 1 1\n");
 
@@ -816,10 +375,10 @@ void WriteDebugMap()
 	fclose(fp);
 }
 
-// Line query code
-static FILE * fplineq;
-static bspnode_t *lineq;
-void WriteCross(FILE *fp, vec2 x)
+// ______________________________________________
+// line query
+
+static void WriteCross(FILE *fp, vec2 x)
 {
 	float xy[4][2];
 	float s = 32.0f;
@@ -843,95 +402,482 @@ void WriteCross(FILE *fp, vec2 x)
 	fprintf(fp, "%f %f 1\n", xy[3][0], xy[3][1]);
 }
 
-void LineQueryRecursive(bspnode_t *n, line_t *line)
+typedef struct linequery_s
 {
-	if (!n->children[0] && !n->children[1])
+	FILE		*fp;
+	bspnode_t	*prev;
+	bool		verbose;
+
+} linequery_t;
+
+static void LineQueryLeaf(void *data, bspnode_t *leaf, vec2 p)
+{
+	linequery_t *q = (linequery_t*)data;
+
+	// are we going from empty to solid or solid to empty?
+	if (q->prev) // && (leaf->empty ^ q->prev->empty))
 	{
-		// are we going from empty to solid or solid to empty?
-		if (lineq) // && (n->empty ^ lineq->empty))
-		{
-			printf("hit point at %f, %f\n", line->v[0][0], line->v[0][1]);
-			WriteCross(fplineq, line->v[0]);
-		}
+		if (q->verbose)
+			printf("hit point at %f, %f\n", p[0], p[1]);
+		WriteCross(q->fp, p);
+	}
+
+	q->prev = leaf;
+}
+
+static void LineQuery(mapjob_t *job, bsptree_t *tree)
+{
+	linequery_t	q;
+
+	q.fp		= OpenOutputFile(job, "lineq.gld", "w");
+	q.prev		= NULL;
+	q.verbose	= job->verbose;
+
+	line_t l;
+	l.v[0][0] = 0.0f;
+	l.v[0][1] = 0.0f;
+	l.v[1][0] = 4096.0f;
+	l.v[1][1] = 4096.0f;
+
+	LineQueryTree(tree, &l, LineQueryLeaf, &q);
+
+	bsptrace_t trace;
+	if (TraceSegment(tree, l.v[0], l.v[1], &trace) && q.verbose)
+		printf("first solid hit at %f, %f\n", trace.point[0], trace.point[1]);
+
+	fclose(q.fp);
+}
+
+// ______________________________________________
+// benchmarks
 
-		lineq = n;
-		return;
+#define	BENCH_POINTS		(1 << 20)
+#define	BENCH_SEGMENTS		(1 << 18)
+#define	BENCH_SEGMENT_LENGTH	512.0f
+#define	BENCH_SWEEP_RADIUS	16.0f
+#define	BENCH_FAN_SEGMENTS	16
+#define	BENCH_FAN_ANGLE		0.1f
+#define	BENCH_BOXES		(1 << 18)
+#define	BENCH_BOX_SIZE		128.0f
+#define	BENCH_BOX_LEAFS		1024
+
+static double Seconds()
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// the same sequence every run so results can be compared between builds
+static float BenchRandom(unsigned int *seed)
+{
+	*seed = *seed * 1664525 + 1013904223;
+
+	return (*seed >> 8) * (1.0f / (1 << 24));
+}
+
+// lines start with the map name so runs over several maps can be told apart
+static void PrintRate(mapjob_t *job, const char *name, int count, double seconds)
+{
+	printf("%-8s %-24s %8.2f M/s\n", job->mapname, name, count / seconds / 1e6);
+}
+
+// batched traces take the same steps as single ones, so the results are the same to the bit
+static bool TracesMatch(const bsptrace_t *a, const bsptrace_t *b)
+{
+	return
+		a->hit == b->hit &&
+		a->fraction == b->fraction &&
+		a->point.x == b->point.x &&
+		a->point.y == b->point.y &&
+		a->leafnum == b->leafnum &&
+		a->nodenum == b->nodenum &&
+		a->plane.a == b->plane.a &&
+		a->plane.b == b->plane.b &&
+		a->plane.c == b->plane.c;
+}
+
+// times the queries against the map's tree with points and segments spread
+// over the map bounds
+static void RunBenchmarks(mapjob_t *job, bsptree_t *tree)
+{
+	unsigned int	seed = 1;
+	box2		bounds;
+	double		start;
+	int		errors = 0;
+
+	bounds.Clear();
+	for (int i = 0; i < job->numvertices; i++)
+		bounds.AddPoint(job->vertices[i]);
+
+	vec2		size = bounds.max - bounds.min;
+	vec2		*points = (vec2*)Malloc(BENCH_POINTS * sizeof(vec2));
+	int		*leafnums = (int*)Malloc(BENCH_POINTS * sizeof(int));
+	int		*batchleafnums = (int*)Malloc(BENCH_POINTS * sizeof(int));
+	vec2		*ends = (vec2*)Malloc(BENCH_SEGMENTS * sizeof(vec2));
+	bsptrace_t	*traces = (bsptrace_t*)Malloc(BENCH_SEGMENTS * sizeof(bsptrace_t));
+	bsptrace_t	*batchtraces = (bsptrace_t*)Malloc(BENCH_SEGMENTS * sizeof(bsptrace_t));
+	vec2		*fanstarts = (vec2*)Malloc(BENCH_SEGMENTS * sizeof(vec2));
+	vec2		*fanends = (vec2*)Malloc(BENCH_SEGMENTS * sizeof(vec2));
+
+	for (int i = 0; i < BENCH_POINTS; i++)
+	{
+		points[i][0] = bounds.min[0] + BenchRandom(&seed) * size[0];
+		points[i][1] = bounds.min[1] + BenchRandom(&seed) * size[1];
 	}
 
-	int side = Line_OnPlaneSide(line, n->plane, globalepsilon);
+	// segments start at the first points
+	for (int i = 0; i < BENCH_SEGMENTS; i++)
+	{
+		float angle = BenchRandom(&seed) * 2.0f * (float)M_PI;
+
+		ends[i][0] = points[i][0] + BENCH_SEGMENT_LENGTH * cosf(angle);
+		ends[i][1] = points[i][1] + BENCH_SEGMENT_LENGTH * sinf(angle);
+	}
 
-	if (side == PLANE_SIDE_FRONT)
-		LineQueryRecursive(n->children[0], line);
-	else if (side == PLANE_SIDE_BACK)
-		LineQueryRecursive(n->children[1], line);
-	else if (side == PLANE_SIDE_CROSS)
+	// the same number of segments again in fans from a shared start, like a
+	// spread of shots or a cone of sight lines
+	for (int i = 0; i < BENCH_SEGMENTS; i += BENCH_FAN_SEGMENTS)
 	{
-		line_t *f, *b;
-		Line_SplitWithPlane(line, n->plane, globalepsilon, &f, &b);
+		float angle = BenchRandom(&seed) * 2.0f * (float)M_PI;
 
-		side = n->plane.PointOnPlaneSide(line->v[0], globalepsilon);
-		if(side == PLANE_SIDE_FRONT)
+		for (int j = 0; j < BENCH_FAN_SEGMENTS; j++)
 		{
-			LineQueryRecursive(n->children[0], f);
-			LineQueryRecursive(n->children[1], b);
-		}
-		else
-		{
-			LineQueryRecursive(n->children[1], b);
-			LineQueryRecursive(n->children[0], f);
+			float a = angle + BENCH_FAN_ANGLE * j / BENCH_FAN_SEGMENTS;
+
+			fanstarts[i + j] = points[i];
+			fanends[i + j][0] = points[i][0] + BENCH_SEGMENT_LENGTH * cosf(a);
+			fanends[i + j][1] = points[i][1] + BENCH_SEGMENT_LENGTH * sinf(a);
 		}
 	}
-	else if (side == PLANE_SIDE_ON)
+
+	start = Seconds();
+	for (int i = 0; i < BENCH_POINTS; i++)
+		leafnums[i] = LocatePoint(tree, points[i]);
+	PrintRate(job, "point location", BENCH_POINTS, Seconds() - start);
+
+	start = Seconds();
+	LocatePoints(tree, points, BENCH_POINTS, batchleafnums);
+	PrintRate(job, "batched point location", BENCH_POINTS, Seconds() - start);
+
+	int numempty = 0;
+	for (int i = 0; i < BENCH_POINTS; i++)
 	{
-		// hmmm	
-		LineQueryRecursive(n->children[0], line);
+		numempty += tree->cleafs[leafnums[i]].empty;
+		errors += batchleafnums[i] != leafnums[i];
 	}
+
+	printf("%-8s %-24s %8.1f%%\n", job->mapname, "points in open space", 100.0f * numempty / BENCH_POINTS);
+
+	start = Seconds();
+	for (int i = 0; i < BENCH_SEGMENTS; i++)
+		TraceSegment(tree, points[i], ends[i], traces + i);
+	PrintRate(job, "segment trace", BENCH_SEGMENTS, Seconds() - start);
+
+	start = Seconds();
+	TraceSegments(tree, points, ends, BENCH_SEGMENTS, batchtraces);
+	PrintRate(job, "batched segment trace", BENCH_SEGMENTS, Seconds() - start);
+
+	for (int i = 0; i < BENCH_SEGMENTS; i++)
+		errors += !TracesMatch(traces + i, batchtraces + i);
+
+	start = Seconds();
+	for (int i = 0; i < BENCH_SEGMENTS; i++)
+		TraceSegment(tree, fanstarts[i], fanends[i], traces + i);
+	PrintRate(job, "fan trace", BENCH_SEGMENTS, Seconds() - start);
+
+	start = Seconds();
+	TraceSegments(tree, fanstarts, fanends, BENCH_SEGMENTS, batchtraces);
+	PrintRate(job, "batched fan trace", BENCH_SEGMENTS, Seconds() - start);
+
+	for (int i = 0; i < BENCH_SEGMENTS; i++)
+		errors += !TracesMatch(traces + i, batchtraces + i);
+
+	start = Seconds();
+	int numswept = 0;
+	for (int i = 0; i < BENCH_SEGMENTS; i++)
+	{
+		bspsweep_t sweep;
+
+		numswept += SweepCircle(tree, points[i], ends[i], BENCH_SWEEP_RADIUS, &sweep);
+	}
+	PrintRate(job, "circle sweep", BENCH_SEGMENTS, Seconds() - start);
+
+	printf("%-8s %-24s %8.1f%%\n", job->mapname, "sweeps that hit", 100.0f * numswept / BENCH_SEGMENTS);
+
+	start = Seconds();
+	long numboxleafs = 0;
+	for (int i = 0; i < BENCH_BOXES; i++)
+	{
+		box2 box;
+
+		box.min = points[i] - vec2(BENCH_BOX_SIZE * 0.5f, BENCH_BOX_SIZE * 0.5f);
+		box.max = points[i] + vec2(BENCH_BOX_SIZE * 0.5f, BENCH_BOX_SIZE * 0.5f);
+
+		numboxleafs += BoxLeafnums(tree, box, leafnums, BENCH_BOX_LEAFS);
+	}
+	PrintRate(job, "box query", BENCH_BOXES, Seconds() - start);
+
+	printf("%-8s %-24s %8.1f\n", job->mapname, "leafs per box", (float)numboxleafs / BENCH_BOXES);
+
+	if (errors)
+		printf("%s: %i batched queries don't match the single queries!\n", job->mapname, errors);
+
+	free(points);
+	free(leafnums);
+	free(batchleafnums);
+	free(ends);
+	free(traces);
+	free(batchtraces);
+	free(fanstarts);
+	free(fanends);
+}
+
+// ______________________________________________
+// map building
+
+static void PrintMapStats(mapjob_t *job)
+{
+	printf("numvertices %i\n", job->numvertices);
+	printf("numlinedefs %i\n", job->numlinedefs);
+	printf("numnodes %i\n", job->numnodes);
+	printf("numleafs %i\n", job->numleafs);
 }
 
-static void LineQuery(bsptree_t *tree)
+static void BuildMap(mapjob_t *job)
 {
-	fplineq = fopen("lineq.gld", "w");
+	bspbuild_t *build = AllocBuild();
+	build->maxcandidates = job->options.maxcandidates;
+	build->heuristic = job->options.heuristic;
+	build->numthreads = job->options.numthreads;
+	build->exact = job->options.exact;
+
+	SetMapData(build, job->vertices, job->numvertices, job->linedefs, job->numlinedefs);
+
+	// the build has its own copy of the map data
+	free(job->vertices);
+	free(job->linedefs);
+	job->vertices = build->vertices;
+	job->linedefs = build->linedefs;
+
+	bsptree_t *tree = BuildTree(build);
+
+	job->numnodes = tree->numnodes;
+	job->numleafs = tree->numleafs;
+
+	if (job->verbose)
+		PrintMapStats(job);
 
-	line_t *l = Line_Alloc();
-	l->v[0][0] = 0.0f;
-	l->v[0][1] = 0.0f;
-	l->v[1][0] = 4096.0f;
-	l->v[1][1] = 4096.0f;
+	MarkEmptyLeafs(tree);
+	
+	BuildLeafPolygons(job, tree);
+
+	WriteDebugMap(job);
+	
+	LineQuery(job, tree);
+
+	if (job->options.benchmark)
+		RunBenchmarks(job, tree);
 
-	lineq = NULL;
-	LineQueryRecursive(tree->root, l);
+	FreeBuild(build);
 
-	fclose(fplineq);
+	job->vertices = NULL;
+	job->linedefs = NULL;
 }
 
-int main(int argc, const char * argv[])
+// maps are handed out to the worker threads in order
+typedef struct buildqueue_s
 {
-	if (argc < 3)
+	pthread_mutex_t	lock;
+	int		nextmap;
+	int		nummaps;
+	mapjob_t	*jobs;
+
+} buildqueue_t;
+
+static void *BuildWorker(void *arg)
+{
+	buildqueue_t *queue = (buildqueue_t*)arg;
+
+	while (1)
 	{
-		printf("lines <wadfile> <mapname>\n");
-		exit(0);
+		int mapnum;
+
+		pthread_mutex_lock(&queue->lock);
+		mapnum = queue->nextmap++;
+		pthread_mutex_unlock(&queue->lock);
+
+		if (mapnum >= queue->nummaps)
+			break;
+
+		BuildMap(queue->jobs + mapnum);
 	}
 
-	Doom_ReadWadFile(argv[1]);
+	return NULL;
+}
+
+static void BuildAllMaps(int numthreads, const buildoptions_t *options)
+{
+	buildqueue_t	queue;
+	pthread_t	*threads;
+	int		nummaps;
+
+	nummaps = Doom_NumMaps();
+	if (!nummaps)
+		Error("No maps found\n");
+
+	// read all the map data up front so the wad can be closed before building
+	queue.jobs = (mapjob_t*)MallocZeroed(nummaps * sizeof(mapjob_t));
 
-	DumpMapData(argv[2]);
+	for (int i = 0; i < nummaps; i++)
+	{
+		char mapname[9];
+
+		Doom_LumpName(Doom_MapLumpNum(i), mapname);
+		DumpMapData(queue.jobs + i, mapname);
+
+		snprintf(queue.jobs[i].outprefix, sizeof(queue.jobs[i].outprefix), "%s_", mapname);
+		queue.jobs[i].options = *options;
+
+		// the maps are already spread over the threads
+		if (!options->benchmark)
+			queue.jobs[i].options.numthreads = 1;
+	}
 
 	Doom_CloseAll();
 
-	bsptree_t *tree = BuildTree();
-	printf("numvertices %i\n", numvertices);
-	printf("numlinedefs %i\n", numlinedefs);
-	printf("numnodes %i\n", tree->numnodes);
-	printf("numleafs %i\n", tree->numleafs);
+	// build the maps on a pool of threads. benchmarks are timed one map at a
+	// time so the maps don't compete for cores
+	if (options->benchmark)
+		numthreads = 1;
+	if (numthreads > nummaps)
+		numthreads = nummaps;
 
-	MarkEmptyLeafs(tree);
-	
-	BuildLeafPolygons(tree);
+	pthread_mutex_init(&queue.lock, NULL);
+	queue.nextmap = 0;
+	queue.nummaps = nummaps;
 
-	WriteDebugMap();
-	
-	LineQuery(tree);
+	threads = (pthread_t*)Malloc(numthreads * sizeof(pthread_t));
 
-	return 0;
+	for (int i = 0; i < numthreads; i++)
+		pthread_create(threads + i, NULL, BuildWorker, &queue);
+	for (int i = 0; i < numthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&queue.lock);
+
+	for (int i = 0; i < nummaps; i++)
+	{
+		mapjob_t *job = queue.jobs + i;
+
+		printf("%-8s vertices %6i linedefs %6i nodes %6i leafs %6i\n",
+				job->mapname,
+				job->numvertices,
+				job->numlinedefs,
+				job->numnodes,
+				job->numleafs);
+	}
+
+	free(threads);
+	free(queue.jobs);
+}
+
+static void Usage()
+{
+	printf("lines [options] <wadfile> <mapname>\n");
+	printf("lines [options] <wadfile> --all-maps\n");
+	printf("\n");
+	printf("options:\n");
+	printf("  --all-maps    build every map in the wad\n");
+	printf("  -j <threads>  number of threads, defaults to the number of cores\n");
+	printf("  -sample <k>   only score the k longest split planes at each node, 0 scores them all\n");
+	printf("  -heuristic <name>\n");
+	printf("                how split planes are scored, one of");
+	for (int i = 0; i < NUM_SPLIT_HEURISTICS; i++)
+		printf(" %s", SplitHeuristicName(i));
+	printf(", defaults to %s\n", SplitHeuristicName(SPLIT_MINSPLITS));
+	printf("  -exact        split with exact fixed point plane tests\n");
+	printf("  -gld          also write the leaf polygons as .gld text\n");
+	printf("  -bench        time the tree queries on each map, one map at a time\n");
+	exit(0);
 }
 
+int main(int argc, const char * argv[])
+{
+	const char	*wadfile = NULL;
+	const char	*mapname = NULL;
+	bool		allmaps = false;
+	buildoptions_t	options;
+
+	options.maxcandidates	= 0;
+	options.heuristic	= SPLIT_MINSPLITS;
+	options.numthreads	= (int)sysconf(_SC_NPROCESSORS_ONLN);
+	options.exact		= false;
+	options.leafgld		= false;
+	options.benchmark	= false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--all-maps"))
+			allmaps = true;
+		else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+			options.numthreads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-sample") && i + 1 < argc)
+			options.maxcandidates = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-heuristic") && i + 1 < argc)
+		{
+			options.heuristic = FindSplitHeuristic(argv[++i]);
+			if (options.heuristic < 0)
+				Usage();
+		}
+		else if (!strcmp(argv[i], "-exact"))
+			options.exact = true;
+		else if (!strcmp(argv[i], "-gld"))
+			options.leafgld = true;
+		else if (!strcmp(argv[i], "-bench"))
+			options.benchmark = true;
+		else if (argv[i][0] == '-')
+			Usage();
+		else if (!wadfile)
+			wadfile = argv[i];
+		else if (!mapname)
+			mapname = argv[i];
+		else
+			Usage();
+	}
+
+	if (!wadfile || (!mapname && !allmaps))
+		Usage();
+
+	if (options.numthreads < 1)
+		options.numthreads = 1;
+
+	// leaf polygons are split many times over, keep them off the global heap
+	PolyPool_Install();
+
+	Doom_ReadWadFile(wadfile);
+
+	if (allmaps)
+	{
+		BuildAllMaps(options.numthreads, &options);
+		PolyPool_Release();
+		return 0;
+	}
+
+	mapjob_t job;
+	memset(&job, 0, sizeof(job));
+	job.verbose = true;
+	job.options = options;
+
+	DumpMapData(&job, mapname);
+
+	Doom_CloseAll();
+
+	BuildMap(&job);
+
+	PolyPool_Release();
+
+	return 0;
+}
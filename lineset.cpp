@@ -0,0 +1,228 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <memory.h>
+#include "common.h"
+#include "plane2.h"
+#include "fixed.h"
+#include "lineset.h"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#define LINESET_SIMD
+#endif
+
+// ______________________________________________
+// line sets
+
+#define	MIN_SET_LINES		64
+
+void LineSet_Init(lineset_t *set)
+{
+	memset(set, 0, sizeof(lineset_t));
+}
+
+void LineSet_Free(lineset_t *set)
+{
+	free(set->x0);
+	LineSet_Init(set);
+}
+
+void LineSet_Clear(lineset_t *set)
+{
+	set->numlines = 0;
+}
+
+// the arrays share one allocation
+static void LineSet_Grow(lineset_t *set)
+{
+	int	maxlines = set->maxlines ? set->maxlines * 2 : MIN_SET_LINES;
+	float	*p = (float*)Malloc(maxlines * 4 * (sizeof(float) + sizeof(fixed_t)));
+	fixed_t	*fp = (fixed_t*)(p + maxlines * 4);
+
+	if (set->numlines)
+	{
+		memcpy(p + maxlines * 0, set->x0, set->numlines * sizeof(float));
+		memcpy(p + maxlines * 1, set->y0, set->numlines * sizeof(float));
+		memcpy(p + maxlines * 2, set->x1, set->numlines * sizeof(float));
+		memcpy(p + maxlines * 3, set->y1, set->numlines * sizeof(float));
+		memcpy(fp + maxlines * 0, set->fx0, set->numlines * sizeof(fixed_t));
+		memcpy(fp + maxlines * 1, set->fy0, set->numlines * sizeof(fixed_t));
+		memcpy(fp + maxlines * 2, set->fx1, set->numlines * sizeof(fixed_t));
+		memcpy(fp + maxlines * 3, set->fy1, set->numlines * sizeof(fixed_t));
+	}
+
+	free(set->x0);
+
+	set->maxlines	= maxlines;
+	set->x0		= p + maxlines * 0;
+	set->y0		= p + maxlines * 1;
+	set->x1		= p + maxlines * 2;
+	set->y1		= p + maxlines * 3;
+	set->fx0	= fp + maxlines * 0;
+	set->fy0	= fp + maxlines * 1;
+	set->fx1	= fp + maxlines * 2;
+	set->fy1	= fp + maxlines * 3;
+}
+
+void LineSet_Add(lineset_t *set, float x0, float y0, float x1, float y1)
+{
+	if (set->numlines == set->maxlines)
+		LineSet_Grow(set);
+
+	set->x0[set->numlines] = x0;
+	set->y0[set->numlines] = y0;
+	set->x1[set->numlines] = x1;
+	set->y1[set->numlines] = y1;
+	set->numlines++;
+}
+
+void LineSet_AddFixed(lineset_t *set, const fixedline_t *l)
+{
+	if (set->numlines == set->maxlines)
+		LineSet_Grow(set);
+
+	set->fx0[set->numlines] = l->v[0][0];
+	set->fy0[set->numlines] = l->v[0][1];
+	set->fx1[set->numlines] = l->v[1][0];
+	set->fy1[set->numlines] = l->v[1][1];
+	set->numlines++;
+}
+
+// ______________________________________________
+// classification
+
+// the distances are worked out in the same order as plane_t::Distance so
+// every path classifies a line the same way as Line_OnPlaneSide
+
+static void ClassifyScalar(const lineset_t *set, int first, int last, float a, float b, float c, float epsilon, int *counts)
+{
+	for (int i = first; i < last; i++)
+	{
+		float d0 = (a * set->x0[i]) + (b * set->y0[i]) + c;
+		float d1 = (a * set->x1[i]) + (b * set->y1[i]) + c;
+
+		bool f0 = d0 > epsilon, b0 = d0 < -epsilon;
+		bool f1 = d1 > epsilon, b1 = d1 < -epsilon;
+
+		if ((f0 && b1) || (b0 && f1))
+			counts[PLANE_SIDE_CROSS]++;
+		else if (b0 || b1)
+			counts[PLANE_SIDE_BACK]++;
+		else if (f0 || f1)
+			counts[PLANE_SIDE_FRONT]++;
+		else
+			counts[PLANE_SIDE_ON]++;
+	}
+}
+
+#ifdef LINESET_SIMD
+
+static int ClassifySSE(const lineset_t *set, int first, int last, float a, float b, float c, float epsilon, int *counts)
+{
+	__m128	va = _mm_set1_ps(a);
+	__m128	vb = _mm_set1_ps(b);
+	__m128	vc = _mm_set1_ps(c);
+	__m128	front = _mm_set1_ps(epsilon);
+	__m128	back = _mm_set1_ps(-epsilon);
+	int	i;
+
+	for (i = first; i + 4 <= last; i += 4)
+	{
+		__m128 d0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(va, _mm_loadu_ps(set->x0 + i)), _mm_mul_ps(vb, _mm_loadu_ps(set->y0 + i))), vc);
+		__m128 d1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(va, _mm_loadu_ps(set->x1 + i)), _mm_mul_ps(vb, _mm_loadu_ps(set->y1 + i))), vc);
+
+		__m128 f0 = _mm_cmpgt_ps(d0, front), b0 = _mm_cmplt_ps(d0, back);
+		__m128 f1 = _mm_cmpgt_ps(d1, front), b1 = _mm_cmplt_ps(d1, back);
+
+		__m128 cross = _mm_or_ps(_mm_and_ps(f0, b1), _mm_and_ps(b0, f1));
+		__m128 anyback = _mm_or_ps(b0, b1);
+		__m128 anyfront = _mm_or_ps(f0, f1);
+
+		int crossmask = _mm_movemask_ps(cross);
+		int backmask = _mm_movemask_ps(anyback) & ~crossmask;
+		int onmask = ~(_mm_movemask_ps(anyfront) | _mm_movemask_ps(anyback)) & 15;
+
+		counts[PLANE_SIDE_CROSS] += __builtin_popcount(crossmask);
+		counts[PLANE_SIDE_BACK] += __builtin_popcount(backmask);
+		counts[PLANE_SIDE_ON] += __builtin_popcount(onmask);
+		counts[PLANE_SIDE_FRONT] += 4 - __builtin_popcount(crossmask | backmask | onmask);
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2")))
+static int ClassifyAVX2(const lineset_t *set, int first, int last, float a, float b, float c, float epsilon, int *counts)
+{
+	__m256	va = _mm256_set1_ps(a);
+	__m256	vb = _mm256_set1_ps(b);
+	__m256	vc = _mm256_set1_ps(c);
+	__m256	front = _mm256_set1_ps(epsilon);
+	__m256	back = _mm256_set1_ps(-epsilon);
+	int	i;
+
+	for (i = first; i + 8 <= last; i += 8)
+	{
+		__m256 d0 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(va, _mm256_loadu_ps(set->x0 + i)), _mm256_mul_ps(vb, _mm256_loadu_ps(set->y0 + i))), vc);
+		__m256 d1 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(va, _mm256_loadu_ps(set->x1 + i)), _mm256_mul_ps(vb, _mm256_loadu_ps(set->y1 + i))), vc);
+
+		__m256 f0 = _mm256_cmp_ps(d0, front, _CMP_GT_OQ), b0 = _mm256_cmp_ps(d0, back, _CMP_LT_OQ);
+		__m256 f1 = _mm256_cmp_ps(d1, front, _CMP_GT_OQ), b1 = _mm256_cmp_ps(d1, back, _CMP_LT_OQ);
+
+		__m256 cross = _mm256_or_ps(_mm256_and_ps(f0, b1), _mm256_and_ps(b0, f1));
+		__m256 anyback = _mm256_or_ps(b0, b1);
+		__m256 anyfront = _mm256_or_ps(f0, f1);
+
+		int crossmask = _mm256_movemask_ps(cross);
+		int backmask = _mm256_movemask_ps(anyback) & ~crossmask;
+		int onmask = ~(_mm256_movemask_ps(anyfront) | _mm256_movemask_ps(anyback)) & 255;
+
+		counts[PLANE_SIDE_CROSS] += __builtin_popcount(crossmask);
+		counts[PLANE_SIDE_BACK] += __builtin_popcount(backmask);
+		counts[PLANE_SIDE_ON] += __builtin_popcount(onmask);
+		counts[PLANE_SIDE_FRONT] += 8 - __builtin_popcount(crossmask | backmask | onmask);
+	}
+
+	return i;
+}
+
+#endif
+
+void LineSet_Classify(const lineset_t *set, int first, int numlines, plane_t plane, float epsilon, int counts[4])
+{
+	int	last = first + numlines;
+	int	i = first;
+
+#ifdef LINESET_SIMD
+	if (__builtin_cpu_supports("avx2"))
+		i = ClassifyAVX2(set, i, last, plane.a, plane.b, plane.c, epsilon, counts);
+	else
+		i = ClassifySSE(set, i, last, plane.a, plane.b, plane.c, epsilon, counts);
+#endif
+
+	ClassifyScalar(set, i, last, plane.a, plane.b, plane.c, epsilon, counts);
+}
+
+// the same classification as FixedLine_OnPlaneSide, without branches
+void LineSet_ClassifyFixed(const lineset_t *set, int first, int numlines, const exactplane_t *plane, int counts[4])
+{
+	int64_t	epsilon = plane->epsilon;
+
+	for (int i = first; i < first + numlines; i++)
+	{
+		int64_t d0 = plane->a * set->fx0[i] + plane->b * set->fy0[i] + plane->c;
+		int64_t d1 = plane->a * set->fx1[i] + plane->b * set->fy1[i] + plane->c;
+
+		int f0 = d0 > epsilon, b0 = d0 < -epsilon;
+		int f1 = d1 > epsilon, b1 = d1 < -epsilon;
+
+		int cross = (f0 & b1) | (b0 & f1);
+		int back = (b0 | b1) & !cross;
+		int on = !(f0 | b0 | f1 | b1);
+
+		counts[PLANE_SIDE_CROSS] += cross;
+		counts[PLANE_SIDE_BACK] += back;
+		counts[PLANE_SIDE_ON] += on;
+		counts[PLANE_SIDE_FRONT] += !(cross | back | on);
+	}
+}
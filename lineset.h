@@ -0,0 +1,46 @@
+#ifndef __LINESET_H__
+#define __LINESET_H__
+
+#include "fixed.h"
+
+class plane_t;
+
+// ______________________________________________
+// line sets
+
+// lines stored as packed endpoint arrays so a plane can be tested against
+// several lines at once. a set holds either float or fixed point lines
+typedef struct lineset_s
+{
+	int	numlines;
+	int	maxlines;
+
+	float	*x0;
+	float	*y0;
+	float	*x1;
+	float	*y1;
+
+	fixed_t	*fx0;
+	fixed_t	*fy0;
+	fixed_t	*fx1;
+	fixed_t	*fy1;
+
+} lineset_t;
+
+void LineSet_Init(lineset_t *set);
+void LineSet_Free(lineset_t *set);
+
+// empties the set, keeping its memory
+void LineSet_Clear(lineset_t *set);
+void LineSet_Add(lineset_t *set, float x0, float y0, float x1, float y1);
+void LineSet_AddFixed(lineset_t *set, const fixedline_t *l);
+
+// adds the number of lines from first on that are on each side of the plane
+// to counts, which is indexed by PLANE_SIDE_*. lines are classified the same
+// way as Line_OnPlaneSide
+void LineSet_Classify(const lineset_t *set, int first, int numlines, plane_t plane, float epsilon, int counts[4]);
+
+// the same for fixed point lines, classified the same way as FixedLine_OnPlaneSide
+void LineSet_ClassifyFixed(const lineset_t *set, int first, int numlines, const exactplane_t *plane, int counts[4]);
+
+#endif
@@ -1,4 +1,3 @@
-#include <assert.h>
 #include <stdlib.h>
 #include <memory.h>
 #include <math.h>
@@ -7,6 +6,10 @@
 #include "plane2.h"
 #include "polygon.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 static int PointOnPlaneSide(vec2 p, plane_t plane, float epsilon)
 {
 	return plane.PointOnPlaneSide(p, epsilon);
@@ -32,27 +35,59 @@ void Polygon_SetMemCallbacks(void *(*alloccallback)(int numbytes), void (*freeca
 	Polygon_MemFree		= freecallback;
 }
 
-static int Polygon_MemSize(int numvertices)
+void Polygon_Init(polygon_t *p)
+{
+	p->maxvertices	= POLYGON_INLINE_VERTICES;
+	p->numvertices	= 0;
+	p->vertices	= p->inlinevertices;
+}
+
+void Polygon_Release(polygon_t *p)
+{
+	if (p->vertices != p->inlinevertices)
+		Polygon_MemFree(p->vertices);
+
+	Polygon_Init(p);
+}
+
+void Polygon_Reserve(polygon_t *p, int numvertices)
 {
-	return sizeof(polygon_t) + (numvertices * sizeof(vec2));
+	vec2	*vertices;
+
+	if (numvertices <= p->maxvertices)
+		return;
+
+	// grow geometrically so adding vertices one at a time stays cheap
+	if (numvertices < p->maxvertices * 2)
+		numvertices = p->maxvertices * 2;
+
+	vertices = (vec2*)Polygon_MemAlloc(numvertices * sizeof(vec2));
+	memcpy(vertices, p->vertices, p->numvertices * sizeof(vec2));
+
+	if (p->vertices != p->inlinevertices)
+		Polygon_MemFree(p->vertices);
+
+	p->maxvertices	= numvertices;
+	p->vertices	= vertices;
 }
 
 polygon_t *Polygon_Alloc(int numvertices)
 {
 	polygon_t	*p;
 
-	int numbytes = Polygon_MemSize(numvertices);
-	p = (polygon_t*)Polygon_MemAlloc(numbytes);
+	p = (polygon_t*)Polygon_MemAlloc(sizeof(polygon_t));
 
-	p->maxvertices	= numvertices;
-	p->numvertices	= 0;
-	p->vertices	= (vec2*)(p + 1);
+	Polygon_Init(p);
+	Polygon_Reserve(p, numvertices);
 
 	return p;
 }
 
 void Polygon_Free(polygon_t* p)
 {
+	if (p->vertices != p->inlinevertices)
+		Polygon_MemFree(p->vertices);
+
 	Polygon_MemFree(p);
 }
 
@@ -61,9 +96,8 @@ polygon_t* Polygon_Copy(polygon_t* p)
 	polygon_t	*c;
 	int		i;
 
-	c = Polygon_Alloc(p->maxvertices);
+	c = Polygon_Alloc(p->numvertices);
 	
-	c->maxvertices = p->maxvertices;
 	c->numvertices = p->numvertices;
 	
 	for (i = 0; i < c->numvertices; i++)
@@ -72,20 +106,26 @@ polygon_t* Polygon_Copy(polygon_t* p)
 	return c;
 }
 
-void Polygon_AddVertex(polygon_t *p, float x, float y)
+static void Polygon_AddPoint(polygon_t *p, vec2 v)
 {
-	if (p->numvertices + 1 >= p->maxvertices)
-		assert(0);
+	if (p->numvertices == p->maxvertices)
+		Polygon_Reserve(p, p->numvertices + 1);
 
-	p->vertices[p->numvertices].x = x;
-	p->vertices[p->numvertices].y = y;
+	p->vertices[p->numvertices] = v;
+	p->numvertices++;
+}
+
+void Polygon_AddVertex(polygon_t *p, float x, float y)
+{
+	Polygon_AddPoint(p, vec2(x, y));
 }
 
 polygon_t *Polygon_Reverse(polygon_t* p)
 {
 	polygon_t	*r;
 
-	r = (polygon_t*)Polygon_Alloc(p->maxvertices);
+	r = (polygon_t*)Polygon_Alloc(p->numvertices);
+	r->numvertices = p->numvertices;
 
 	for (int i = 0; i < p->numvertices; i++)
 		r->vertices[(i + 1) % p->numvertices] = p->vertices[p->numvertices - 1 - i];
@@ -132,155 +172,281 @@ float Polygon_Area(polygon_t *p)
 	return area;
 }
 
-void Polygon_SplitWithPlane(polygon_t *in, plane_t plane, float epsilon, polygon_t **front, polygon_t **back)
+// ______________________________________________
+// splitting
+
+// per vertex distances and sides for a split, kept on the stack unless the
+// polygon is big
+typedef struct polysplit_s
 {
-	int		sides[32+4];
-	int		counts[3];		// FRONT, BACK, ON
-	int		i, j;
-	polygon_t	*f, *b;
-	int		maxpts;
-	
-	counts[0] = counts[1] = counts[2] = 0;
+	float	*dists;
+	int	*sides;
+	int	counts[3];		// FRONT, BACK, ON
 
-	// classify each point
+	// edges going from one side to the other, each adds a point to both pieces
+	int	numcrossings;
+
+	float	distbuf[POLYGON_INLINE_VERTICES + 1];
+	int	sidebuf[POLYGON_INLINE_VERTICES + 1];
+
+} polysplit_t;
+
+// the same as Distance for every vertex, the vector path does the same
+// operations in the same order so the results are identical
+static void PlaneDistances(const vec2 *vertices, int numvertices, plane_t plane, float *dists)
+{
+	int i = 0;
+
+#ifdef __SSE2__
+	__m128	va = _mm_set1_ps(plane.a);
+	__m128	vb = _mm_set1_ps(plane.b);
+	__m128	vc = _mm_set1_ps(plane.c);
+
+	for (; i + 4 <= numvertices; i += 4)
 	{
-		for (i = 0; i < in->numvertices; i++)
-		{
-			sides[i] = PointOnPlaneSide(in->vertices[i], plane, epsilon);
-			counts[sides[i]]++;
-		}
+		__m128 v01 = _mm_loadu_ps(&vertices[i + 0].x);
+		__m128 v23 = _mm_loadu_ps(&vertices[i + 2].x);
+		__m128 x = _mm_shuffle_ps(v01, v23, _MM_SHUFFLE(2, 0, 2, 0));
+		__m128 y = _mm_shuffle_ps(v01, v23, _MM_SHUFFLE(3, 1, 3, 1));
 
-		sides[i] = sides[0];
+		_mm_storeu_ps(dists + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(va, x), _mm_mul_ps(vb, y)), vc));
 	}
-	
-	// all points are on the plane
-	if (!counts[PLANE_SIDE_FRONT] && !counts[PLANE_SIDE_BACK])
+#endif
+
+	for (; i < numvertices; i++)
+		dists[i] = (plane.a * vertices[i].x) + (plane.b * vertices[i].y) + plane.c;
+}
+
+static void Split_Classify(polysplit_t *split, const polygon_t *in, plane_t plane, float epsilon)
+{
+	int	n = in->numvertices;
+	int	i;
+
+	split->dists = split->distbuf;
+	split->sides = split->sidebuf;
+
+	// only big polygons need more room
+	if (n + 1 > POLYGON_INLINE_VERTICES + 1)
 	{
-		*front = NULL;
-		*back = NULL;
-		return;
+		split->dists = (float*)Polygon_MemAlloc((n + 1) * (sizeof(float) + sizeof(int)));
+		split->sides = (int*)(split->dists + n + 1);
 	}
 
-	// all points are front side
-	if (!counts[PLANE_SIDE_BACK])
+	PlaneDistances(in->vertices, n, plane, split->dists);
+
+	split->counts[0] = split->counts[1] = split->counts[2] = 0;
+
+	for (i = 0; i < n; i++)
 	{
-		*front = Polygon_Copy(in);
-		*back = NULL;
-		return;
+		float d = split->dists[i];
+
+		// PLANE_SIDE_ON is 2, front takes it to 0 and back to 1
+		int side = PLANE_SIDE_ON - 2 * (d > epsilon) - (d < -epsilon);
+
+		split->sides[i] = side;
+		split->counts[side]++;
 	}
 
-	// all points are back side
-	if (!counts[PLANE_SIDE_FRONT])
+	// wrap around so the last edge doesn't need a special case
+	split->dists[n] = split->dists[0];
+	split->sides[n] = split->sides[0];
+
+	split->numcrossings = 0;
+
+	if (split->counts[PLANE_SIDE_FRONT] && split->counts[PLANE_SIDE_BACK])
 	{
-		*front = NULL;
-		*back = Polygon_Copy(in);
-		return;
+		for (i = 0; i < n; i++)
+			split->numcrossings += (split->sides[i] ^ split->sides[i + 1]) == 1;
 	}
+}
 
-	// split the polygon
-	maxpts = in->numvertices+4;	// cant use counts[0]+2 because
-								// of fp grouping errors
+static void Split_Free(polysplit_t *split)
+{
+	if (split->dists != split->distbuf)
+		Polygon_MemFree(split->dists);
+}
 
-	*front = f = Polygon_Alloc(maxpts);
-	*back = b = Polygon_Alloc(maxpts);
-		
-	for (i = 0; i < in->numvertices; i++)
+// emits the pieces of a polygon that crosses the plane, either piece can be skipped
+static void Split_Emit(polysplit_t *split, const polygon_t *in, plane_t plane, polygon_t *f, polygon_t *b)
+{
+	int	n = in->numvertices;
+	int	nf = 0, nb = 0;
+	int	*sides = split->sides;
+	float	*dists = split->dists;
+	vec2	discard[2];
+	vec2	*fv, *bv;
+
+	// each vertex is stored to both pieces and the counts only advance on
+	// the sides it belongs to, so there's one extra slot to write over
+	if (f)
+	{
+		Polygon_Reserve(f, split->counts[PLANE_SIDE_FRONT] + split->counts[PLANE_SIDE_ON] + split->numcrossings + 1);
+		fv = f->vertices;
+	}
+	else
 	{
-		vec2	p1, p2, mid;
+		fv = discard;
+	}
 
-		p1 = in->vertices[i];
-		p2 = in->vertices[(i + 1) % in->numvertices];
-		
-		if (sides[i] == PLANE_SIDE_ON)
-		{
-			// add the point to the front polygon
-			f->vertices[f->numvertices] = p1;
-			f->numvertices++;
-
-			// Add the point to the back polygon
-			b->vertices[b->numvertices] = p1;
-			b->numvertices++;
-			
-			continue;
-		}
-	
-		if (sides[i] == PLANE_SIDE_FRONT)
-		{
-			// add the point to the front polygon
-			f->vertices[f->numvertices] = p1;
-			f->numvertices++;
-		}
+	if (b)
+	{
+		Polygon_Reserve(b, split->counts[PLANE_SIDE_BACK] + split->counts[PLANE_SIDE_ON] + split->numcrossings + 1);
+		bv = b->vertices;
+	}
+	else
+	{
+		bv = discard;
+	}
 
-		if (sides[i] == PLANE_SIDE_BACK)
-		{
-			b->vertices[b->numvertices] = p1;
-			b->numvertices++;
-		}
+	for (int i = 0; i < n; i++)
+	{
+		vec2	p1 = in->vertices[i];
+		int	side = sides[i];
 
-		// if the next point doesn't straddle the plane continue
-		if (sides[i+1] == PLANE_SIDE_ON || sides[i+1] == sides[i])
-		{
+		fv[nf] = p1;
+		nf += f && side != PLANE_SIDE_BACK;
+		bv[nb] = p1;
+		nb += b && side != PLANE_SIDE_FRONT;
+
+		// only an edge going straight from front to back or back to front needs a split point
+		if ((side ^ sides[i + 1]) != 1)
 			continue;
-		}
-		
-		// The next point crosses the plane, so generate a split point
-		
-		for (j = 0; j < 2; j++)
+
+		vec2	p2 = in->vertices[i + 1 < n ? i + 1 : 0];
+		vec2	mid;
+		float	dot = dists[i] / (dists[i] - dists[i + 1]);
+
+		for (int j = 0; j < 2; j++)
 		{
 			// avoid round off error when possible
 			if (plane[j] == 1)
-			{
 				mid[j] = -plane[2];
-			}
 			else if (plane[j] == -1)
-			{
 				mid[j] = plane[2];
-			}
 			else
-			{
-				float dist1, dist2, dot;
-				
-				dist1 = Distance(plane, p1);
-				dist2 = Distance(plane, p2);
-				dot = dist1 / (dist1 - dist2);
 				mid[j] = ((1.0f - dot) * p1[j]) + (dot * p2[j]);
-			}
 		}
-			
-		f->vertices[f->numvertices] = mid;
-		f->numvertices++;
-		b->vertices[b->numvertices] = mid;
-		b->numvertices++;
+
+		fv[nf] = mid;
+		nf += f != NULL;
+		bv[nb] = mid;
+		nb += b != NULL;
 	}
-	
-	if (f->numvertices > maxpts || b->numvertices > maxpts)
+
+	if (f)
+		f->numvertices = nf;
+	if (b)
+		b->numvertices = nb;
+}
+
+void Polygon_SplitWithPlane(polygon_t *in, plane_t plane, float epsilon, polygon_t **front, polygon_t **back)
+{
+	polysplit_t	split;
+
+	Split_Classify(&split, in, plane, epsilon);
+
+	*front = *back = NULL;
+
+	if (!split.counts[PLANE_SIDE_FRONT] && !split.counts[PLANE_SIDE_BACK])
 	{
-		assert(0);
+		// all points are on the plane
 	}
-
-	if (f->numvertices > 32 || b->numvertices > 32)
+	else if (!split.counts[PLANE_SIDE_BACK])
 	{
-		assert(0);
+		// all points are front side
+		*front = Polygon_Copy(in);
 	}
+	else if (!split.counts[PLANE_SIDE_FRONT])
+	{
+		// all points are back side
+		*back = Polygon_Copy(in);
+	}
+	else
+	{
+		*front = Polygon_Alloc(0);
+		*back = Polygon_Alloc(0);
+
+		Split_Emit(&split, in, plane, *front, *back);
+	}
+
+	Split_Free(&split);
 }
 
 polygon_t *Polygon_ClipWithPlane(polygon_t *p, plane_t plane, float epsilon)
 {
-	polygon_t *f, *b;
-	
-	// split the polygon
-	Polygon_SplitWithPlane(p, plane, epsilon, &f, &b);
-	
-	// free the original polygon
+	polysplit_t	split;
+	polygon_t	*f = NULL;
+
+	Split_Classify(&split, p, plane, epsilon);
+
+	// a polygon entirely in front is kept as it is
+	if (!split.counts[PLANE_SIDE_BACK] && split.counts[PLANE_SIDE_FRONT])
+	{
+		Split_Free(&split);
+		return p;
+	}
+
+	if (split.counts[PLANE_SIDE_FRONT])
+	{
+		f = Polygon_Alloc(0);
+		Split_Emit(&split, p, plane, f, NULL);
+	}
+
+	Split_Free(&split);
 	Polygon_Free(p);
-	
-	// free the backside polygon if it exists
-	if(b)
-		Polygon_Free(b);
-	
+
 	return f;
 }
 
+polygon_t *Polygon_ClipWithPlanes(polygon_t *p, const plane_t *planes, int numplanes, float epsilon)
+{
+	polygon_t	work[2];
+	polygon_t	*cur = p;
+	int		next = 0;
+
+	Polygon_Init(&work[0]);
+	Polygon_Init(&work[1]);
+
+	for (int i = 0; i < numplanes && cur; i++)
+	{
+		polysplit_t split;
+
+		Split_Classify(&split, cur, planes[i], epsilon);
+
+		if (!split.counts[PLANE_SIDE_FRONT])
+		{
+			// clipped away
+			cur = NULL;
+		}
+		else if (split.counts[PLANE_SIDE_BACK])
+		{
+			// the pieces go back and forth between the two work polygons
+			Split_Emit(&split, cur, planes[i], &work[next], NULL);
+			cur = &work[next];
+			next ^= 1;
+		}
+
+		Split_Free(&split);
+	}
+
+	if (!cur)
+	{
+		Polygon_Free(p);
+		p = NULL;
+	}
+	else if (cur != p)
+	{
+		Polygon_Reserve(p, cur->numvertices);
+		memcpy(p->vertices, cur->vertices, cur->numvertices * sizeof(vec2));
+		p->numvertices = cur->numvertices;
+	}
+
+	Polygon_Release(&work[0]);
+	Polygon_Release(&work[1]);
+
+	return p;
+}
+
 // Classify where a polygon is with respect to a plane
 int Polygon_OnPlaneSide(polygon_t *p, plane_t plane, float epsilon)
 {
@@ -3,17 +3,24 @@
 
 //#include "vec3.h"
 //#include "plane.h"
+#include "vec2.h"
 
-class vec2;
 class box2;
 class plane_t;
 
+// vertices kept inside the polygon, most leaf regions fit
+#define	POLYGON_INLINE_VERTICES		16
+
+// the vertices are either the inline ones or spill into their own block
+// once the polygon grows past them, so there's no limit on the vertex count
 typedef struct polygon_s
 {
 	int	maxvertices;
 	int	numvertices;
 	vec2	*vertices;
 
+	vec2	inlinevertices[POLYGON_INLINE_VERTICES];
+
 } polygon_t;
 
 void Polygon_SetMemCallbacks(void *(*alloccallback)(int numbytes), void (*freecallback)(void *p));
@@ -24,11 +31,19 @@ polygon_t *Polygon_Alloc(int numvertices);
 // frees the polygon
 void Polygon_Free(polygon_t* p);
 
+// sets up a polygon that's already allocated, such as one on the stack, and
+// releases its vertices when it's done with
+void Polygon_Init(polygon_t *p);
+void Polygon_Release(polygon_t *p);
+
+// makes room for at least numvertices
+void Polygon_Reserve(polygon_t *p, int numvertices);
+
 // creates a copy of the polygon
 polygon_t* Polygon_Copy(polygon_t* p);
 
-// adds a vertex to the polygon
-void Polygon_AddVertex(float x, float y, float z);
+// adds a vertex to the polygon, growing it if needed
+void Polygon_AddVertex(polygon_t *p, float x, float y);
 
 // reverses the winding order of the polygon
 polygon_t *Polygon_Reverse(polygon_t* p);
@@ -45,9 +60,14 @@ float Polygon_Area(polygon_t *p);
 // split the polygon with plane returning the front and back pieces if they exist
 void Polygon_SplitWithPlane(polygon_t *in, plane_t plane, float epsilon, polygon_t **front, polygon_t **back);
 
-// clip the polygon with the plane returning the front piece if it exists
+// clip the polygon with the plane returning the front piece if it exists, the
+// polygon is either returned or freed
 polygon_t *Polygon_ClipWithPlane(polygon_t *p, plane_t plane, float epsilon);
 
+// the same as clipping with each plane in turn, such as the planes above a
+// leaf, without allocating for each plane
+polygon_t *Polygon_ClipWithPlanes(polygon_t *p, const plane_t *planes, int numplanes, float epsilon);
+
 // return which side of the plane the polygon is on
 int Polygon_OnPlaneSide(polygon_t *p, plane_t plane, float epsilon);
 
@@ -0,0 +1,242 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "common.h"
+#include "polygon.h"
+#include "polypool.h"
+
+// ______________________________________________
+// pool memory
+
+// chunks are 32 bytes up to 4K, bigger allocations go straight to malloc
+#define	POOL_MIN_SHIFT		5
+#define	POOL_NUM_CLASSES	8
+#define	POOL_BLOCK_SIZE		(64 * 1024)
+
+// a thread hands chunks back to the shared lists once it holds this many of
+// a class, and chunks move between them this many at a time
+#define	POOL_CACHE_MAX		64
+#define	POOL_BATCH		32
+
+// in front of every allocation, keeps the memory after it 16 byte aligned
+typedef struct poolchunk_s
+{
+	struct poolchunk_s	*next;
+	int			sizeclass;	// -1 for malloc'd allocations
+	int			pad;
+
+} poolchunk_t;
+
+typedef struct poolblock_s
+{
+	struct poolblock_s	*next;
+	long			pad;
+
+} poolblock_t;
+
+typedef struct poolcache_s
+{
+	// the release the lists were filled after, stale lists are dropped
+	int			generation;
+
+	poolchunk_t		*chunks[POOL_NUM_CLASSES];
+	int			numchunks[POOL_NUM_CLASSES];
+
+} poolcache_t;
+
+static pthread_mutex_t	poollock = PTHREAD_MUTEX_INITIALIZER;
+static poolblock_t	*poolblocks;
+static poolchunk_t	*poolchunks[POOL_NUM_CLASSES];
+static int		poolgeneration = 1;
+
+static pthread_once_t	poolkeyonce = PTHREAD_ONCE_INIT;
+static pthread_key_t	poolkey;
+
+static __thread poolcache_t	poolcache;
+
+static int SizeClass(int numbytes)
+{
+	int sizeclass = 0;
+
+	while ((1 << (sizeclass + POOL_MIN_SHIFT)) < numbytes)
+		sizeclass++;
+
+	return sizeclass < POOL_NUM_CLASSES ? sizeclass : -1;
+}
+
+// moves up to count chunks from the front of one list onto another, returns the number moved
+static int MoveChunks(poolchunk_t **from, poolchunk_t **to, int count)
+{
+	int i;
+
+	for (i = 0; i < count && *from; i++)
+	{
+		poolchunk_t *c = *from;
+
+		*from = c->next;
+		c->next = *to;
+		*to = c;
+	}
+
+	return i;
+}
+
+// hands a thread's chunks back when it exits so they aren't lost until the next release
+static void FlushCache(void *data)
+{
+	poolcache_t *cache = (poolcache_t*)data;
+
+	pthread_mutex_lock(&poollock);
+
+	if (cache->generation == poolgeneration)
+	{
+		for (int i = 0; i < POOL_NUM_CLASSES; i++)
+			MoveChunks(&cache->chunks[i], &poolchunks[i], cache->numchunks[i]);
+	}
+
+	pthread_mutex_unlock(&poollock);
+}
+
+static void MakePoolKey()
+{
+	pthread_key_create(&poolkey, FlushCache);
+}
+
+static void CheckCache(poolcache_t *cache)
+{
+	if (cache->generation == poolgeneration)
+		return;
+
+	// a thread's first use of the pool, or the blocks were released since
+	if (!cache->generation)
+	{
+		pthread_once(&poolkeyonce, MakePoolKey);
+		pthread_setspecific(poolkey, cache);
+	}
+
+	for (int i = 0; i < POOL_NUM_CLASSES; i++)
+	{
+		cache->chunks[i]	= NULL;
+		cache->numchunks[i]	= 0;
+	}
+
+	cache->generation = poolgeneration;
+}
+
+static void CarveBlock(int sizeclass)
+{
+	poolblock_t	*block;
+	int		chunksize = 1 << (sizeclass + POOL_MIN_SHIFT);
+	char		*p;
+
+	block = (poolblock_t*)Malloc(sizeof(poolblock_t) + POOL_BLOCK_SIZE);
+	block->next = poolblocks;
+	poolblocks = block;
+
+	p = (char*)(block + 1);
+
+	for (int i = 0; i < POOL_BLOCK_SIZE / chunksize; i++, p += chunksize)
+	{
+		poolchunk_t *c = (poolchunk_t*)p;
+
+		c->sizeclass = sizeclass;
+		c->next = poolchunks[sizeclass];
+		poolchunks[sizeclass] = c;
+	}
+}
+
+static void RefillCache(poolcache_t *cache, int sizeclass)
+{
+	pthread_mutex_lock(&poollock);
+
+	if (!poolchunks[sizeclass])
+		CarveBlock(sizeclass);
+
+	cache->numchunks[sizeclass] += MoveChunks(&poolchunks[sizeclass], &cache->chunks[sizeclass], POOL_BATCH);
+
+	pthread_mutex_unlock(&poollock);
+}
+
+static void TrimCache(poolcache_t *cache, int sizeclass)
+{
+	pthread_mutex_lock(&poollock);
+
+	cache->numchunks[sizeclass] -= MoveChunks(&cache->chunks[sizeclass], &poolchunks[sizeclass], POOL_BATCH);
+
+	pthread_mutex_unlock(&poollock);
+}
+
+void *PolyPool_Alloc(int numbytes)
+{
+	poolcache_t	*cache = &poolcache;
+	poolchunk_t	*c;
+	int		sizeclass = SizeClass(numbytes + (int)sizeof(poolchunk_t));
+
+	if (sizeclass < 0)
+	{
+		c = (poolchunk_t*)Malloc(sizeof(poolchunk_t) + numbytes);
+		c->sizeclass = -1;
+		return c + 1;
+	}
+
+	CheckCache(cache);
+
+	if (!cache->chunks[sizeclass])
+		RefillCache(cache, sizeclass);
+
+	c = cache->chunks[sizeclass];
+	cache->chunks[sizeclass] = c->next;
+	cache->numchunks[sizeclass]--;
+
+	return c + 1;
+}
+
+void PolyPool_Free(void *p)
+{
+	poolcache_t	*cache = &poolcache;
+	poolchunk_t	*c = (poolchunk_t*)p - 1;
+	int		sizeclass = c->sizeclass;
+
+	if (sizeclass < 0)
+	{
+		free(c);
+		return;
+	}
+
+	CheckCache(cache);
+
+	c->next = cache->chunks[sizeclass];
+	cache->chunks[sizeclass] = c;
+	cache->numchunks[sizeclass]++;
+
+	if (cache->numchunks[sizeclass] > POOL_CACHE_MAX)
+		TrimCache(cache, sizeclass);
+}
+
+void PolyPool_Install()
+{
+	Polygon_SetMemCallbacks(PolyPool_Alloc, PolyPool_Free);
+}
+
+void PolyPool_Release()
+{
+	poolblock_t *block, *next;
+
+	pthread_mutex_lock(&poollock);
+
+	for (block = poolblocks; block; block = next)
+	{
+		next = block->next;
+		free(block);
+	}
+
+	poolblocks = NULL;
+
+	for (int i = 0; i < POOL_NUM_CLASSES; i++)
+		poolchunks[i] = NULL;
+
+	// every thread drops its lists the next time it uses the pool
+	poolgeneration++;
+
+	pthread_mutex_unlock(&poollock);
+}
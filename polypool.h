@@ -0,0 +1,22 @@
+#ifndef __POLYPOOL_H__
+#define __POLYPOOL_H__
+
+// ______________________________________________
+// polygon pool
+
+// an allocator for polygons and their vertices. memory comes from large blocks
+// split into power of two size classes, each thread keeps its own free lists
+// and only takes the lock to trade chunks with the shared lists in batches.
+// memory can be freed on a different thread to the one that allocated it
+
+// makes the pool the polygon allocator through Polygon_SetMemCallbacks
+void PolyPool_Install();
+
+void *PolyPool_Alloc(int numbytes);
+void PolyPool_Free(void *p);
+
+// releases all the pool's blocks at once. every polygon must already have been
+// freed and no other thread may be using the pool
+void PolyPool_Release();
+
+#endif
@@ -0,0 +1,256 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <memory.h>
+#include <pthread.h>
+#include "common.h"
+#include "threads.h"
+
+// ______________________________________________
+// task queues
+
+typedef struct task_s
+{
+	taskfunc_t	func;
+	void		*data;
+
+} task_t;
+
+// a ring of tasks, the owning worker pushes and pops at the tail and thieves
+// take from the head
+typedef struct taskqueue_s
+{
+	pthread_mutex_t		lock;
+	task_t			*tasks;
+	int			maxtasks;
+	int			head;
+	int			numtasks;
+
+} taskqueue_t;
+
+struct threadpool_s
+{
+	int			numworkers;
+	taskqueue_t		*queues;
+
+	// tasks spawned but not finished, and tasks sitting in a queue
+	int			numpending;
+	int			numqueued;
+
+	// idle workers sleep until a task is queued or the last task finishes
+	pthread_mutex_t		idlelock;
+	pthread_cond_t		idle;
+	int			numidle;
+};
+
+#define	MIN_QUEUE_TASKS		64
+
+static void Queue_Push(taskqueue_t *queue, task_t task)
+{
+	pthread_mutex_lock(&queue->lock);
+
+	if (queue->numtasks == queue->maxtasks)
+	{
+		int	maxtasks = queue->maxtasks ? queue->maxtasks * 2 : MIN_QUEUE_TASKS;
+		task_t	*tasks = (task_t*)Malloc(maxtasks * sizeof(task_t));
+
+		for (int i = 0; i < queue->numtasks; i++)
+			tasks[i] = queue->tasks[(queue->head + i) % queue->maxtasks];
+
+		free(queue->tasks);
+		queue->tasks	= tasks;
+		queue->maxtasks	= maxtasks;
+		queue->head	= 0;
+	}
+
+	queue->tasks[(queue->head + queue->numtasks) % queue->maxtasks] = task;
+	queue->numtasks++;
+
+	pthread_mutex_unlock(&queue->lock);
+}
+
+// newest task first, keeps the owner working on the subtree it just split
+static bool Queue_Pop(taskqueue_t *queue, task_t *task)
+{
+	bool	found = false;
+
+	pthread_mutex_lock(&queue->lock);
+
+	if (queue->numtasks)
+	{
+		queue->numtasks--;
+		*task = queue->tasks[(queue->head + queue->numtasks) % queue->maxtasks];
+		found = true;
+	}
+
+	pthread_mutex_unlock(&queue->lock);
+
+	return found;
+}
+
+// oldest task first, which tends to be the largest piece of work
+static bool Queue_Steal(taskqueue_t *queue, task_t *task)
+{
+	bool	found = false;
+
+	pthread_mutex_lock(&queue->lock);
+
+	if (queue->numtasks)
+	{
+		*task = queue->tasks[queue->head];
+		queue->head = (queue->head + 1) % queue->maxtasks;
+		queue->numtasks--;
+		found = true;
+	}
+
+	pthread_mutex_unlock(&queue->lock);
+
+	return found;
+}
+
+// ______________________________________________
+// workers
+
+typedef struct worker_s
+{
+	threadpool_t	*pool;
+	int		worker;
+
+} worker_t;
+
+static bool GetTask(threadpool_t *pool, int worker, task_t *task)
+{
+	if (Queue_Pop(pool->queues + worker, task))
+		return true;
+
+	for (int i = 1; i < pool->numworkers; i++)
+	{
+		if (Queue_Steal(pool->queues + (worker + i) % pool->numworkers, task))
+			return true;
+	}
+
+	return false;
+}
+
+static void WorkerLoop(threadpool_t *pool, int worker)
+{
+	task_t	task;
+
+	for (;;)
+	{
+		if (GetTask(pool, worker, &task))
+		{
+			__atomic_sub_fetch(&pool->numqueued, 1, __ATOMIC_SEQ_CST);
+
+			task.func(pool, worker, task.data);
+
+			// wake everyone up when the last task is done so they can exit
+			if (!__atomic_sub_fetch(&pool->numpending, 1, __ATOMIC_SEQ_CST))
+			{
+				pthread_mutex_lock(&pool->idlelock);
+				pthread_cond_broadcast(&pool->idle);
+				pthread_mutex_unlock(&pool->idlelock);
+			}
+			continue;
+		}
+
+		if (!__atomic_load_n(&pool->numpending, __ATOMIC_SEQ_CST))
+			break;
+
+		// nothing to steal, wait for more work
+		pthread_mutex_lock(&pool->idlelock);
+		if (__atomic_load_n(&pool->numpending, __ATOMIC_SEQ_CST) &&
+			!__atomic_load_n(&pool->numqueued, __ATOMIC_SEQ_CST))
+		{
+			pool->numidle++;
+			pthread_cond_wait(&pool->idle, &pool->idlelock);
+			pool->numidle--;
+		}
+		pthread_mutex_unlock(&pool->idlelock);
+	}
+}
+
+static void *WorkerThread(void *data)
+{
+	worker_t *w = (worker_t*)data;
+
+	WorkerLoop(w->pool, w->worker);
+
+	return NULL;
+}
+
+// ______________________________________________
+// pool
+
+void Thread_Spawn(threadpool_t *pool, int worker, taskfunc_t func, void *data)
+{
+	task_t	task;
+
+	task.func = func;
+	task.data = data;
+
+	__atomic_add_fetch(&pool->numpending, 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&pool->numqueued, 1, __ATOMIC_SEQ_CST);
+
+	Queue_Push(pool->queues + worker, task);
+
+	pthread_mutex_lock(&pool->idlelock);
+	if (pool->numidle)
+		pthread_cond_signal(&pool->idle);
+	pthread_mutex_unlock(&pool->idlelock);
+}
+
+int Thread_NumWorkers(threadpool_t *pool)
+{
+	return pool->numworkers;
+}
+
+void Thread_Run(int numthreads, taskfunc_t func, void *data)
+{
+	threadpool_t	pool;
+	pthread_t	*threads;
+	worker_t	*workers;
+
+	if (numthreads < 1)
+		numthreads = 1;
+
+	memset(&pool, 0, sizeof(pool));
+	pool.numworkers	= numthreads;
+	pool.queues	= (taskqueue_t*)MallocZeroed(numthreads * sizeof(taskqueue_t));
+
+	for (int i = 0; i < numthreads; i++)
+		pthread_mutex_init(&pool.queues[i].lock, NULL);
+
+	pthread_mutex_init(&pool.idlelock, NULL);
+	pthread_cond_init(&pool.idle, NULL);
+
+	// the first task goes on the calling thread's queue
+	Thread_Spawn(&pool, 0, func, data);
+
+	threads = (pthread_t*)Malloc(numthreads * sizeof(pthread_t));
+	workers = (worker_t*)Malloc(numthreads * sizeof(worker_t));
+
+	for (int i = 1; i < numthreads; i++)
+	{
+		workers[i].pool		= &pool;
+		workers[i].worker	= i;
+		pthread_create(threads + i, NULL, WorkerThread, workers + i);
+	}
+
+	WorkerLoop(&pool, 0);
+
+	for (int i = 1; i < numthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_cond_destroy(&pool.idle);
+	pthread_mutex_destroy(&pool.idlelock);
+
+	for (int i = 0; i < numthreads; i++)
+	{
+		pthread_mutex_destroy(&pool.queues[i].lock);
+		free(pool.queues[i].tasks);
+	}
+
+	free(pool.queues);
+	free(workers);
+	free(threads);
+}
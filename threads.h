@@ -0,0 +1,22 @@
+#ifndef __THREADS_H__
+#define __THREADS_H__
+
+// ______________________________________________
+// task pool
+
+// a pool of worker threads that run tasks from their own queue first and steal
+// the oldest tasks from the other workers when it runs dry. tasks may spawn
+// more tasks, Thread_Run returns once every task has finished
+typedef struct threadpool_s threadpool_t;
+
+typedef void (*taskfunc_t)(threadpool_t *pool, int worker, void *data);
+
+// runs the task on a pool of numthreads threads, the calling thread is worker 0
+void Thread_Run(int numthreads, taskfunc_t func, void *data);
+
+// queues a task on the worker's own queue, only call from inside a running task
+void Thread_Spawn(threadpool_t *pool, int worker, taskfunc_t func, void *data);
+
+int Thread_NumWorkers(threadpool_t *pool);
+
+#endif